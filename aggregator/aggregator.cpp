@@ -0,0 +1,388 @@
+// The MIT License (MIT)
+//
+// Copyright (c) 2016 Johannes Frohnhofen
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// -----------------------------------------------------------------------------
+//
+// Reads the MIDI streams of many boards on serial lines in one process and
+// publishes every board on its own ALSA sequencer port.
+//
+//   aggregator [-p] [-b baud] device...
+//
+// -p writes tagged records to stdout instead of ALSA (see record_t), as used
+// by loadtest. -b sets the line rate, 31250 by default. The daemon exits
+// once the last device has gone away.
+
+#include <asm/ioctls.h>
+#include <asm/termbits.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+#ifndef NO_ALSA
+#include <alsa/asoundlib.h>
+#endif
+
+// <sys/ioctl.h> clashes with the kernel termios2 definitions
+extern "C" int ioctl(int fd, unsigned long request, ...);
+
+#define MIDI_BAUD_RATE 31250
+#define MAX_BOARDS     256
+#define READ_SIZE      256
+#define EPOLL_EVENTS   64
+
+//// PARSER ////
+
+// Incremental MIDI parser with running status. Real-time bytes are passed
+// on wherever they appear, system common messages cancel running status,
+// SysEx (the board's programming replies) is skipped.
+typedef struct {
+  uint8_t status;
+  uint8_t length;
+  uint8_t count;
+  uint8_t data[2];
+  bool    sysex;
+} parser_t;
+
+inline uint8_t data_length(uint8_t status)
+{
+  switch(status & 0xf0) {
+    case 0xc0:
+    case 0xd0:
+      return 1;
+    case 0xf0:
+      return status == 0xf2 ? 2 : status == 0xf1 || status == 0xf3 ? 1 : 0;
+    default:
+      return 2;
+  }
+}
+
+// Feeds one byte and returns the length of the message completed by it in
+// msg, or 0.
+inline uint8_t parse_byte(parser_t *parser, uint8_t byte, uint8_t *msg)
+{
+  if(byte >= 0xf8) {
+    msg[0] = byte;
+    return 1;
+  }
+
+  if(byte & 0x80) {
+    parser->sysex = byte == 0xf0;
+    parser->status = byte;
+    parser->length = data_length(byte);
+    parser->count = 0;
+
+    if(byte >= 0xf0 && !parser->length) {
+      parser->status = 0;
+      if(byte == 0xf6) {
+        msg[0] = byte;
+        return 1;
+      }
+    }
+    return 0;
+  }
+
+  if(parser->sysex || !parser->status) {
+    return 0;
+  }
+
+  parser->data[parser->count++] = byte;
+  if(parser->count < parser->length) {
+    return 0;
+  }
+
+  msg[0] = parser->status;
+  msg[1] = parser->data[0];
+  msg[2] = parser->data[1];
+  parser->count = 0;
+
+  if(parser->status >= 0xf0) {
+    parser->status = 0;
+  }
+
+  return 1 + parser->length;
+}
+
+//// BOARDS ////
+
+typedef struct {
+  int         fd;
+  const char *path;
+  parser_t    parser;
+  int         port;
+} board_t;
+
+// One record per message in pipe mode.
+typedef struct {
+  uint8_t board;
+  uint8_t length;
+  uint8_t msg[3];
+} record_t;
+
+board_t  boards[MAX_BOARDS];
+int      board_count;
+int      boards_open;
+int      epoll_fd;
+bool     pipe_mode;
+
+#ifndef NO_ALSA
+snd_seq_t *seq;
+#endif
+
+// Raw 8N1 at any rate through termios2, so USB serial adapters can run at
+// 31250 baud. On a pty the rate is ignored.
+inline bool line_setup(int fd, int baud)
+{
+  struct termios2 tio;
+
+  if(ioctl(fd, TCGETS2, &tio) < 0) {
+    return false;
+  }
+
+  tio.c_iflag = 0;
+  tio.c_oflag = 0;
+  tio.c_lflag = 0;
+  tio.c_cflag = BOTHER | CS8 | CREAD | CLOCAL;
+  tio.c_ispeed = baud;
+  tio.c_ospeed = baud;
+  tio.c_cc[VMIN] = 1;
+  tio.c_cc[VTIME] = 0;
+
+  return ioctl(fd, TCSETS2, &tio) == 0;
+}
+
+inline bool board_open(board_t *board, int index, const char *path, int baud)
+{
+  struct epoll_event event;
+
+  board->path = path;
+  board->fd = open(path, O_RDONLY | O_NOCTTY | O_NONBLOCK);
+  if(board->fd < 0 || !line_setup(board->fd, baud)) {
+    perror(path);
+    return false;
+  }
+
+  event.events = EPOLLIN;
+  event.data.u32 = index;
+  if(epoll_ctl(epoll_fd, EPOLL_CTL_ADD, board->fd, &event) < 0) {
+    perror("epoll_ctl");
+    return false;
+  }
+
+  boards_open++;
+  return true;
+}
+
+inline void board_close(board_t *board)
+{
+  fprintf(stderr, "%s: closed\n", board->path);
+  epoll_ctl(epoll_fd, EPOLL_CTL_DEL, board->fd, 0);
+  close(board->fd);
+  board->fd = -1;
+  boards_open--;
+}
+
+//// ALSA ////
+
+#ifndef NO_ALSA
+
+inline bool alsa_init()
+{
+  if(snd_seq_open(&seq, "default", SND_SEQ_OPEN_OUTPUT, 0) < 0) {
+    fprintf(stderr, "cannot open the ALSA sequencer\n");
+    return false;
+  }
+  snd_seq_set_client_name(seq, "Electric Piano");
+
+  for(int i = 0; i < board_count; ++i) {
+    char name[64];
+    snprintf(name, sizeof(name), "Board %d (%s)", i, boards[i].path);
+    boards[i].port = snd_seq_create_simple_port(seq, name,
+      SND_SEQ_PORT_CAP_READ | SND_SEQ_PORT_CAP_SUBS_READ,
+      SND_SEQ_PORT_TYPE_MIDI_GENERIC | SND_SEQ_PORT_TYPE_APPLICATION);
+    if(boards[i].port < 0) {
+      fprintf(stderr, "cannot create a sequencer port for %s\n", boards[i].path);
+      return false;
+    }
+  }
+
+  return true;
+}
+
+// Direct delivery to the subscribers, without a queue.
+inline void alsa_publish(board_t *board, const uint8_t *msg)
+{
+  snd_seq_event_t event;
+  uint8_t channel = msg[0] & 0x0f;
+
+  snd_seq_ev_clear(&event);
+
+  switch(msg[0] & 0xf0) {
+    case 0x80:
+      snd_seq_ev_set_noteoff(&event, channel, msg[1], msg[2]);
+      break;
+    case 0x90:
+      snd_seq_ev_set_noteon(&event, channel, msg[1], msg[2]);
+      break;
+    case 0xa0:
+      snd_seq_ev_set_keypress(&event, channel, msg[1], msg[2]);
+      break;
+    case 0xb0:
+      snd_seq_ev_set_controller(&event, channel, msg[1], msg[2]);
+      break;
+    case 0xc0:
+      snd_seq_ev_set_pgmchange(&event, channel, msg[1]);
+      break;
+    case 0xd0:
+      snd_seq_ev_set_chanpress(&event, channel, msg[1]);
+      break;
+    case 0xe0:
+      snd_seq_ev_set_pitchbend(&event, channel, (msg[1] | (msg[2] << 7)) - 0x2000);
+      break;
+    default:
+      // system messages are not forwarded
+      return;
+  }
+
+  snd_seq_ev_set_source(&event, board->port);
+  snd_seq_ev_set_subs(&event);
+  snd_seq_ev_set_direct(&event);
+  snd_seq_event_output_direct(seq, &event);
+}
+
+#endif
+
+//// MAIN ////
+
+// Parses what one read returned and publishes it right away; in pipe mode
+// the records of one read go out in one write.
+inline void board_input(int index, const uint8_t *buffer, int size)
+{
+  board_t *board = &boards[index];
+  record_t records[READ_SIZE];
+  int count = 0;
+  uint8_t msg[3];
+
+  for(int i = 0; i < size; ++i) {
+    uint8_t length = parse_byte(&board->parser, buffer[i], msg);
+    if(!length) {
+      continue;
+    }
+
+    if(pipe_mode) {
+      records[count].board = index;
+      records[count].length = length;
+      memcpy(records[count].msg, msg, sizeof(msg));
+      count++;
+    }
+#ifndef NO_ALSA
+    else {
+      alsa_publish(board, msg);
+    }
+#endif
+  }
+
+  if(count && write(STDOUT_FILENO, records, count * sizeof(record_t)) < 0) {
+    perror("write");
+    exit(1);
+  }
+}
+
+int main(int argc, char **argv)
+{
+  struct epoll_event events[EPOLL_EVENTS];
+  uint8_t buffer[READ_SIZE];
+  int baud = MIDI_BAUD_RATE;
+  int option;
+
+  while((option = getopt(argc, argv, "pb:")) != -1) {
+    switch(option) {
+      case 'p':
+        pipe_mode = true;
+        break;
+      case 'b':
+        baud = atoi(optarg);
+        break;
+      default:
+        fprintf(stderr, "usage: %s [-p] [-b baud] device...\n", argv[0]);
+        return 1;
+    }
+  }
+
+  board_count = argc - optind;
+  if(board_count < 1 || board_count > MAX_BOARDS) {
+    fprintf(stderr, "%s: between 1 and %d devices\n", argv[0], MAX_BOARDS);
+    return 1;
+  }
+
+#ifdef NO_ALSA
+  if(!pipe_mode) {
+    fprintf(stderr, "%s: built without ALSA, use -p\n", argv[0]);
+    return 1;
+  }
+#endif
+
+  epoll_fd = epoll_create1(0);
+  if(epoll_fd < 0) {
+    perror("epoll_create1");
+    return 1;
+  }
+
+  for(int i = 0; i < board_count; ++i) {
+    if(!board_open(&boards[i], i, argv[optind + i], baud)) {
+      return 1;
+    }
+  }
+
+#ifndef NO_ALSA
+  if(!pipe_mode && !alsa_init()) {
+    return 1;
+  }
+#endif
+
+  while(boards_open) {
+    int ready = epoll_wait(epoll_fd, events, EPOLL_EVENTS, -1);
+
+    if(ready < 0 && errno != EINTR) {
+      perror("epoll_wait");
+      return 1;
+    }
+
+    for(int i = 0; i < ready; ++i) {
+      int index = events[i].data.u32;
+      int size = read(boards[index].fd, buffer, sizeof(buffer));
+
+      if(size > 0) {
+        board_input(index, buffer, size);
+      } else if(size == 0 || errno != EAGAIN) {
+        // a pty whose other end closed reports EIO
+        board_close(&boards[index]);
+      }
+    }
+  }
+
+  return 0;
+}
@@ -0,0 +1,344 @@
+// The MIT License (MIT)
+//
+// Copyright (c) 2016 Johannes Frohnhofen
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+//
+// -----------------------------------------------------------------------------
+//
+// Load test for the aggregator: simulated boards on ptys, the aggregator in
+// pipe mode reading all of them. For 1, 2, 4, ... up to max boards it prints
+// the latency from writing a message to the pty to reading its record from
+// the aggregator, and the CPU time the aggregator used.
+//
+//   loadtest [-r events/s] [-s seconds] [-m max boards] aggregator
+//
+// A simulated board sends what the firmware sends with the compact output
+// profile: running status note-ons, interrupted by sustain pedal changes and
+// the odd SysEx reply. Its note-ons carry a sequence number in note and
+// velocity, which identifies them in the records; bit 6 of the velocity is
+// always set, so none of them reads as a note-off (velocity 0).
+
+#define _GNU_SOURCE 1
+
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/wait.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+#define MAX_BOARDS     256
+#define SEQUENCE_SIZE  0x2000
+#define TICK_NS        1000000
+
+typedef struct {
+  uint8_t board;
+  uint8_t length;
+  uint8_t msg[3];
+} record_t;
+
+typedef struct {
+  int      master;
+  int      slave;
+  uint8_t  running;
+  uint16_t sequence;
+  double   due;
+  uint64_t sent[SEQUENCE_SIZE];
+} board_t;
+
+board_t boards[MAX_BOARDS];
+
+inline uint64_t now_ns()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// User plus system time of a process in clock ticks.
+inline long cpu_ticks(pid_t pid)
+{
+  char path[64], stat[1024];
+  long utime = 0, stime = 0;
+
+  snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+  FILE *file = fopen(path, "r");
+  if(!file) {
+    return 0;
+  }
+  if(fgets(stat, sizeof(stat), file)) {
+    // the fields after the command name, which may contain spaces
+    char *fields = strrchr(stat, ')');
+    sscanf(fields + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %ld %ld", &utime, &stime);
+  }
+  fclose(file);
+
+  return utime + stime;
+}
+
+inline bool board_open(board_t *board)
+{
+  struct termios tio;
+
+  memset(board, 0, sizeof(*board));
+  board->master = posix_openpt(O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+  if(board->master < 0 || grantpt(board->master) || unlockpt(board->master)) {
+    return false;
+  }
+
+  // raw before the first byte, kept open so the setting stays
+  board->slave = open(ptsname(board->master), O_RDWR | O_NOCTTY | O_CLOEXEC);
+  if(board->slave < 0 || tcgetattr(board->slave, &tio)) {
+    return false;
+  }
+  cfmakeraw(&tio);
+
+  return tcsetattr(board->slave, TCSANOW, &tio) == 0;
+}
+
+inline void board_close(board_t *board)
+{
+  close(board->master);
+  close(board->slave);
+}
+
+// Writes one event of the board, with running status as the firmware does.
+inline void board_send(board_t *board, uint64_t now)
+{
+  uint8_t buffer[16];
+  uint8_t size = 0;
+  uint16_t sequence = board->sequence++;
+
+  // the reply goes first, every sequence % 64 == 31 is also % 16 == 15
+  if(sequence % 64 == 31) {
+    static const uint8_t reply[] = { 0xf0, 0x00, 0x70, 0x01, 0x02, 0x00, 0x02, 0x00, 0xf7 };
+    board->running = 0;
+    memcpy(buffer, reply, sizeof(reply));
+    size = sizeof(reply);
+  } else if(sequence % 16 == 15) {
+    board->running = 0xb0;
+    buffer[size++] = 0xb0;
+    buffer[size++] = 0x40;
+    buffer[size++] = sequence & 0x10 ? 0x40 : 0x00;
+  } else {
+    if(board->running != 0x90) {
+      board->running = 0x90;
+      buffer[size++] = 0x90;
+    }
+    buffer[size++] = sequence & 0x7f;
+    buffer[size++] = 0x40 | ((sequence >> 7) & 0x3f);
+    board->sent[sequence % SEQUENCE_SIZE] = now;
+  }
+
+  if(write(board->master, buffer, size) != size) {
+    perror("write");
+  }
+}
+
+inline double percentile(std::vector<uint64_t> &latencies, double p)
+{
+  if(latencies.empty()) {
+    return 0;
+  }
+  size_t index = std::min(latencies.size() - 1, (size_t)(latencies.size() * p));
+  std::nth_element(latencies.begin(), latencies.begin() + index, latencies.end());
+  return latencies[index] / 1000.0;
+}
+
+inline bool run(const char *aggregator, int count, double rate, int seconds)
+{
+  std::vector<uint64_t> latencies;
+  std::vector<char*> args;
+  int output[2];
+  uint64_t received = 0, lost = 0;
+
+  for(int i = 0; i < count; ++i) {
+    if(!board_open(&boards[i])) {
+      perror("pty");
+      return false;
+    }
+  }
+
+  if(pipe2(output, O_CLOEXEC)) {
+    perror("pipe");
+    return false;
+  }
+
+  args.push_back((char*)aggregator);
+  args.push_back((char*)"-p");
+  for(int i = 0; i < count; ++i) {
+    args.push_back(strdup(ptsname(boards[i].master)));
+  }
+  args.push_back(0);
+
+  pid_t pid = fork();
+  if(!pid) {
+    dup2(output[1], STDOUT_FILENO);
+    close(output[0]);
+    execv(aggregator, args.data());
+    perror(aggregator);
+    _exit(1);
+  }
+  close(output[1]);
+  fcntl(output[0], F_SETFL, O_NONBLOCK);
+
+  // ptsname returns a static buffer, the paths were copied
+  for(size_t i = 2; i + 1 < args.size(); ++i) {
+    free(args[i]);
+  }
+
+  // one tick per millisecond sends what is due on every board
+  int timer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+  struct itimerspec spec = { { 0, TICK_NS }, { 0, TICK_NS } };
+  timerfd_settime(timer, 0, &spec, 0);
+
+  int epoll_fd = epoll_create1(0);
+  struct epoll_event event;
+  event.events = EPOLLIN;
+  event.data.fd = timer;
+  epoll_ctl(epoll_fd, EPOLL_CTL_ADD, timer, &event);
+  event.data.fd = output[0];
+  epoll_ctl(epoll_fd, EPOLL_CTL_ADD, output[0], &event);
+
+  // give the aggregator time to open the ptys
+  usleep(100000);
+
+  uint64_t start = now_ns(), end = start + seconds * 1000000000ULL;
+  long cpu_start = cpu_ticks(pid);
+  record_t records[256];
+  size_t pending = 0;
+
+  while(now_ns() < end) {
+    struct epoll_event events[2];
+    int ready = epoll_wait(epoll_fd, events, 2, 10);
+
+    for(int i = 0; i < ready; ++i) {
+      if(events[i].data.fd == timer) {
+        uint64_t expirations;
+        if(read(timer, &expirations, sizeof(expirations)) < 0) {
+          continue;
+        }
+        uint64_t now = now_ns();
+        for(int b = 0; b < count; ++b) {
+          for(boards[b].due += rate * expirations / 1000; boards[b].due >= 1; boards[b].due -= 1) {
+            board_send(&boards[b], now);
+          }
+        }
+        continue;
+      }
+
+      int size = read(output[0], (uint8_t*)records + pending, sizeof(records) - pending);
+      if(size <= 0) {
+        continue;
+      }
+      uint64_t now = now_ns();
+      pending += size;
+      size_t complete = pending / sizeof(record_t);
+      for(size_t r = 0; r < complete; ++r) {
+        record_t *record = &records[r];
+        if(record->msg[0] != 0x90 || !(record->msg[2] & 0x40) || record->board >= count) {
+          continue;
+        }
+        uint16_t sequence = record->msg[1] | ((record->msg[2] & 0x3f) << 7);
+        uint64_t sent = boards[record->board].sent[sequence % SEQUENCE_SIZE];
+        if(sent) {
+          latencies.push_back(now - sent);
+          received++;
+        } else {
+          lost++;
+        }
+      }
+      pending -= complete * sizeof(record_t);
+      memmove(records, (uint8_t*)records + complete * sizeof(record_t), pending);
+    }
+  }
+
+  long cpu = cpu_ticks(pid) - cpu_start;
+
+  for(int i = 0; i < count; ++i) {
+    board_close(&boards[i]);
+  }
+  close(output[0]);
+  close(timer);
+  close(epoll_fd);
+  waitpid(pid, 0, 0);
+
+  printf("%6d %10.0f %10lu %10.1f %10.1f %10.1f %8.1f%%\n",
+    count, rate * count, (unsigned long)received,
+    percentile(latencies, 0.5), percentile(latencies, 0.99), percentile(latencies, 1.0),
+    100.0 * cpu / sysconf(_SC_CLK_TCK) / seconds);
+  if(lost) {
+    printf("       %lu records without a matching send\n", (unsigned long)lost);
+  }
+
+  return true;
+}
+
+int main(int argc, char **argv)
+{
+  double rate = 500;
+  int seconds = 5;
+  int max_boards = 64;
+  int option;
+
+  while((option = getopt(argc, argv, "r:s:m:")) != -1) {
+    switch(option) {
+      case 'r':
+        rate = atof(optarg);
+        break;
+      case 's':
+        seconds = atoi(optarg);
+        break;
+      case 'm':
+        max_boards = std::min(atoi(optarg), MAX_BOARDS);
+        break;
+      default:
+        fprintf(stderr, "usage: %s [-r events/s] [-s seconds] [-m max boards] aggregator\n", argv[0]);
+        return 1;
+    }
+  }
+
+  if(optind != argc - 1) {
+    fprintf(stderr, "usage: %s [-r events/s] [-s seconds] [-m max boards] aggregator\n", argv[0]);
+    return 1;
+  }
+
+  signal(SIGPIPE, SIG_IGN);
+
+  printf("%6s %10s %10s %10s %10s %10s %9s\n",
+    "boards", "events/s", "received", "p50 us", "p99 us", "max us", "cpu");
+
+  for(int count = 1; count <= max_boards; count *= 2) {
+    if(!run(argv[optind], count, rate, seconds)) {
+      return 1;
+    }
+  }
+
+  return 0;
+}
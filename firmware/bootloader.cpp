@@ -72,7 +72,8 @@ typedef enum {
   ERROR_INVALID_CHECKSUM,
   ERROR_UNKNOWN_COMMAND,
   ERROR_INVALID_PAYLOAD_SIZE,
-  ERROR_INVALID_PAGE_NUMBER
+  ERROR_INVALID_PAGE_NUMBER,
+  ERROR_VERIFY_MISMATCH
 } error_t;
 
 typedef struct {
@@ -82,7 +83,10 @@ typedef struct {
       uint8_t command;
       union {
         uint8_t checksum;
-        uint8_t error;
+        struct {
+          uint8_t error;
+          uint8_t error_offset;
+        };
         struct {
           uint8_t page_no;
           uint8_t page_data[SPM_PAGESIZE];
@@ -102,7 +106,7 @@ uint16_t  payload_size;
 inline bool bootloader_active()
 {
   DDRD  = _BV(PD5) | _BV(PD6);
-  PORTD = _BV(PD3) | _BV(PD4);
+  PORTD = _BV(PD3) | _BV(PD4) | _BV(PD5);
 
   _delay_us(10);
 
@@ -167,6 +171,14 @@ inline void reply_error(uint8_t error)
   send_msg(sizeof(msg.error));
 }
 
+inline void reply_mismatch(uint8_t offset)
+{
+  msg.command = REPLY_ERROR;
+  msg.error = ERROR_VERIFY_MISMATCH;
+  msg.error_offset = offset;
+  send_msg(sizeof(msg.error) + sizeof(msg.error_offset));
+}
+
 inline void reply_data(command_t command, uint16_t data_size)
 {
   msg.command = command;
@@ -175,7 +187,9 @@ inline void reply_data(command_t command, uint16_t data_size)
 
 // COMMANDS
 
-inline void command_write()
+// Returns the offset of the first byte that does not read back as written,
+// or SPM_PAGESIZE if the whole page matches.
+inline uint16_t command_write()
 {
   uint32_t page = msg.page_no * SPM_PAGESIZE;
   uint8_t  *buffer = msg.page_data;
@@ -196,6 +210,15 @@ inline void command_write()
   boot_page_write(page);
   boot_spm_busy_wait();
   boot_rww_enable();
+
+  for(uint16_t addr = 0; addr < SPM_PAGESIZE; ++addr)
+  {
+    if(pgm_read_byte(page + addr) != msg.page_data[addr]) {
+      return addr;
+    }
+  }
+
+  return SPM_PAGESIZE;
 }
 
 inline void command_read()
@@ -229,13 +252,18 @@ inline void process_msg()
       reply_success();
       break;
 
-    case COMMAND_WRITE:
+    case COMMAND_WRITE: {
       CHECK(payload_size == SPM_PAGESIZE + sizeof(msg.page_no),
         ERROR_INVALID_PAYLOAD_SIZE)
       CHECK(msg.page_no < NUM_PAGES, ERROR_INVALID_PAGE_NUMBER)
-      command_write();
+      uint16_t offset = command_write();
+      if(offset != SPM_PAGESIZE) {
+        reply_mismatch(offset);
+        break;
+      }
       reply_success();
       break;
+    }
 
     case COMMAND_VERIFY:
       CHECK(payload_size == sizeof(msg.page_no), ERROR_INVALID_PAYLOAD_SIZE)
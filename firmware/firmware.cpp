@@ -24,11 +24,18 @@
 //
 
 #include <avr/io.h>
+#include <avr/eeprom.h>
 #include <avr/interrupt.h>
 #include <avr/pgmspace.h>
-#include <util/delay.h>
+#include <util/atomic.h>
+#include <util/delay_basic.h>
+#include <math.h>
+#include <stdbool.h>
+#include <string.h>
 
 #define MIDI_BAUD_RATE     31250
+#define MIDI_ID            0x70
+#define VERSION            0x01
 
 #define MIDI_A0            0x15
 #define MIDI_NOTE_ON       0x90
@@ -37,102 +44,1903 @@
 #define MIDI_PROGRAM       0xc0
 #define MIDI_SUSTAIN_PEDAL 0x40
 #define MIDI_SOFT_PEDAL    0x43
+#define MIDI_HIGH_RES      0x58
+#define MIDI_RELEASE       0x40
 
 #define SUSTAIN_PEDAL      PD3
 #define SOFT_PEDAL         PD4
+#define SOFT_UART_TX       PD5
+
+#define UART_TX_SIZE       32
+#define SOFT_UART_SIZE     32
+
+#define PORT_PRIMARY       _BV(0)
+#define PORT_SECONDARY     _BV(1)
+#define PORT_BOTH          (PORT_PRIMARY | PORT_SECONDARY)
+#define PORT_COUNTER       _BV(2)
+#define MIDI_PORTS         3
+
+#define SHAPE_RUNNING      _BV(0)
+#define SHAPE_NOTE_OFF     _BV(1)
+#define SHAPE_HIGH_RES     _BV(2)
+#define ENCODER_OPS        26
+
+#define KEY_COUNT          88
+#define CHANNELS           6
+#define SCAN_STEPS         (CHANNELS * 2)
+#define SETTLE_US          30
+#define SETTLE_MAX_US      47
+
+#define OUTPUT_BUDGET      4
+#define OUTPUT_EVENT_SIZE  9
+
+#define CURVE_GAMMA        40
+#define CURVE_MIN          18
+#define CURVE_MAX          127
+#define CURVE_KNEE         31
+#define CURVE_RANGE        4000
+
+#define PEDAL_DEBOUNCE     156
+#define PEDAL_QUEUE_SIZE   4
+
+#define MSG_PARAMS_SIZE    8
+#define MSG_EMPTY          0xff
+
+#define PROFILE_BUCKETS    32
+#define PROFILE_PERIOD     96
+
+#define PASS_SETTLE_US     400
+#define PASS_WORK_US       112
+#define PASS_TICKS         ((PASS_SETTLE_US + PASS_WORK_US) / 64)
+#define PASS_PLANES        9
+#define PASS_CATCH_UP      16
+
+#define TEST_OUTLIERS      16
 
 #define for_set_bits(BIT, VAR) \
   for(uint8_t BIT=0; VAR>0; BIT++, VAR>>=1) \
     if(VAR & 1)
 
-#define min(a, b) ((a) < (b) ? (a) : (b))
+#define min(a, b) ((a) < (b) ? (a) : (b))
+
+// With the profiler the helpers of the main loop stay out of line, so their
+// samples are told apart by symbol instead of all landing in main.
+#ifdef PROFILER
+#define PROFILED __attribute__ ((noinline))
+#else
+#define PROFILED
+#endif
+
+#define KEY_INDEX(CHANNEL, LINE) (((LINE) >> 3) * 0x28 + pgm_read_byte(&channel_keys[(CHANNEL)]) + ((LINE) & 0b111))
+
+// The upper lines start at key 40, so lines 0-7 of board channel 5 address
+// keys 40-47 a second time. No key is known to be wired to them; the factory
+// test records them apart, after the last key, and reports any activity.
+#define KEY_ALIAS(CHANNEL, LINE) ((LINE) < 8 && pgm_read_byte(&channel_keys[(CHANNEL)]) == 0x28)
+
+#define TEST_SLOT(CHANNEL, LINE) (KEY_ALIAS(CHANNEL, LINE) ? KEY_COUNT + (LINE) : KEY_INDEX(CHANNEL, LINE))
+
+#define KEY_NOTE(KEY) (MIDI_A0 + (KEY))
+
+#define SETTLE_COUNT(US) ((US) * (F_CPU / 1000000UL) / 3)
+
+#define READ_LINES(STEP, VAR) \
+  PORTB = pgm_read_byte(&channel_addr[(STEP)]); \
+  _delay_loop_1(channel_settle[(STEP)]); \
+  VAR = (PINC << 8) | PINA;
+
+// Mux addresses in scan order. Channels are scanned in the order of their
+// low three select bits as a Gray cycle (board channels 0, 2, 3, 1, 5, 4)
+// and every other channel reads its B row first, so each step, including
+// the one back to the start of the pass, flips a single select bit and the
+// mux never passes through a third address on the way. channel and chan
+// below are scan positions; channel_keys maps them to the first key of the
+// board channel. Both tables live in flash, like every constant table here;
+// the 1 KB of SRAM is kept for state and the stack.
+const uint8_t channel_addr[SCAN_STEPS] PROGMEM = {
+  0b0000, 0b1000, 0b1010, 0b0010, 0b0110, 0b1110,
+  0b1100, 0b0100, 0b0101, 0b1101, 0b1001, 0b0001
+};
+
+const uint8_t channel_keys[CHANNELS] PROGMEM = {
+  0x00, 0x10, 0x18, 0x08, 0x28, 0x20
+};
+
+// Settle time before each step is read, in _delay_loop_1 counts (3 cycles).
+// With SETTLE_US on every step a pass spends 360 us settling. The default is
+// on the safe side and stays there: glitch rates of shorter settle times have
+// not been measured, so shortening the pass is left to the user, who can tune
+// single steps down with SET_SETTLE, store them for the next boot and watch
+// for stray notes. At 1 us per step the pass would save up to 348 us.
+uint8_t EEMEM stored_settle[SCAN_STEPS];
+
+uint8_t channel_settle[SCAN_STEPS] = {
+  SETTLE_COUNT(SETTLE_US), SETTLE_COUNT(SETTLE_US), SETTLE_COUNT(SETTLE_US),
+  SETTLE_COUNT(SETTLE_US), SETTLE_COUNT(SETTLE_US), SETTLE_COUNT(SETTLE_US),
+  SETTLE_COUNT(SETTLE_US), SETTLE_COUNT(SETTLE_US), SETTLE_COUNT(SETTLE_US),
+  SETTLE_COUNT(SETTLE_US), SETTLE_COUNT(SETTLE_US), SETTLE_COUNT(SETTLE_US)
+};
+
+inline void settle_init()
+{
+  uint16_t total = 0;
+
+  for(uint8_t step = 0; step < SCAN_STEPS; ++step) {
+    uint8_t us = eeprom_read_byte(&stored_settle[step]);
+    if(us && us <= SETTLE_MAX_US) {
+      channel_settle[step] = SETTLE_COUNT(us);
+    }
+    total += channel_settle[step];
+  }
+
+#ifdef PASS_TIMING
+  // stored one by one, the steps may no longer fit a pass together
+  if(total > SETTLE_COUNT(PASS_SETTLE_US)) {
+    memset(channel_settle, SETTLE_COUNT(SETTLE_US), sizeof(channel_settle));
+  }
+#endif
+}
+
+// Reads both rows of a channel, each with its own timestamp.
+PROFILED inline void read_channel(uint8_t chan, uint16_t *inputA, uint16_t *inputB,
+  uint16_t *timestampA, uint16_t *timestampB)
+{
+  if(chan & 1) {
+    READ_LINES(chan << 1, *inputB);
+    *timestampB = TCNT1;
+    READ_LINES((chan << 1) + 1, *inputA);
+    *timestampA = TCNT1;
+  } else {
+    READ_LINES(chan << 1, *inputA);
+    *timestampA = TCNT1;
+    READ_LINES((chan << 1) + 1, *inputB);
+    *timestampB = TCNT1;
+  }
+}
+
+
+// Bytes are queued and sent from the data register empty interrupt, so the
+// main loop only waits when the queue is full.
+uint8_t          uart_tx_buffer[UART_TX_SIZE];
+volatile uint8_t uart_tx_head;
+volatile uint8_t uart_tx_tail;
+
+inline void uart_init()
+{
+  uint16_t baud = (((F_CPU) + 8UL * (MIDI_BAUD_RATE)) / (16UL * (MIDI_BAUD_RATE)) - 1UL);
+
+  UBRRH = baud >> 8;
+  UBRRL = baud;
+  UCSRB = _BV(RXEN) | _BV(TXEN);
+}
+
+ISR(USART_UDRE_vect)
+{
+  UDR = uart_tx_buffer[uart_tx_tail];
+  uart_tx_tail = (uart_tx_tail + 1) % UART_TX_SIZE;
+
+  if(uart_tx_tail == uart_tx_head) {
+    UCSRB &= ~_BV(UDRIE);
+  }
+}
+
+PROFILED inline void uart_putc(uint8_t byte)
+{
+  uint8_t head = (uart_tx_head + 1) % UART_TX_SIZE;
+
+  while(head == uart_tx_tail);
+
+  uart_tx_buffer[uart_tx_head] = byte;
+  uart_tx_head = head;
+  UCSRB |= _BV(UDRIE);
+}
+
+inline uint8_t uart_room()
+{
+  return (uint8_t)(uart_tx_tail - uart_tx_head - 1) % UART_TX_SIZE;
+}
+
+//// SOFT UART ////
+
+// Second MIDI out on PD5. Timer2 runs in CTC mode at one compare per bit
+// (F_CPU / 8 / 31250 = 64 counts, exact at 16 MHz), so the bit clock never
+// drifts; the handler drives the level computed on the previous tick before
+// doing anything else. Edge jitter is therefore bounded by the longest
+// handler that can delay it (the UART receiver or the pedal interrupt, well
+// below 10% of a bit), which is inside what MIDI receivers tolerate.
+uint8_t          soft_uart_buffer[SOFT_UART_SIZE];
+volatile uint8_t soft_uart_head;
+volatile uint8_t soft_uart_tail;
+volatile bool    soft_uart_idle;
+uint8_t          soft_uart_level;
+uint8_t          soft_uart_bits;
+uint16_t         soft_uart_shift;
+
+inline void soft_uart_init()
+{
+  DDRD |= _BV(SOFT_UART_TX);
+  PORTD |= _BV(SOFT_UART_TX);
+
+  soft_uart_idle = true;
+
+  OCR2 = F_CPU / 8 / MIDI_BAUD_RATE - 1;
+  TCCR2 = _BV(WGM21) | _BV(CS21);
+}
+
+ISR(TIMER2_COMP_vect)
+{
+  if(soft_uart_level) {
+    PORTD |= _BV(SOFT_UART_TX);
+  } else {
+    PORTD &= ~_BV(SOFT_UART_TX);
+  }
+
+  if(soft_uart_bits) {
+    soft_uart_level = soft_uart_shift & 1;
+    soft_uart_shift >>= 1;
+    soft_uart_bits--;
+  } else if(soft_uart_tail != soft_uart_head) {
+    // start bit, then 8 data bits and the stop bit from the shift register
+    soft_uart_level = 0;
+    soft_uart_shift = soft_uart_buffer[soft_uart_tail] | 0x100;
+    soft_uart_bits = 9;
+    soft_uart_tail = (soft_uart_tail + 1) % SOFT_UART_SIZE;
+  } else {
+    TIMSK &= ~_BV(OCIE2);
+    soft_uart_idle = true;
+  }
+}
+
+PROFILED inline void soft_uart_putc(uint8_t byte)
+{
+  uint8_t head = (soft_uart_head + 1) % SOFT_UART_SIZE;
+
+  while(head == soft_uart_tail);
+
+  soft_uart_buffer[soft_uart_head] = byte;
+  soft_uart_head = head;
+
+  if(soft_uart_idle) {
+    // the first tick keeps the line idle and fetches the byte
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+      soft_uart_idle = false;
+      soft_uart_level = 1;
+      soft_uart_bits = 0;
+      TCNT2 = 0;
+      TIFR = _BV(OCF2);
+      TIMSK |= _BV(OCIE2);
+    }
+  }
+}
+
+inline uint8_t soft_uart_room()
+{
+  return (uint8_t)(soft_uart_tail - soft_uart_head - 1) % SOFT_UART_SIZE;
+}
+
+//// MIDI ////
+
+// Notes below route.split (a key index) go to route.low, the others to
+// route.high, controls and programs to route.control. Each is a mask of
+// PORT_PRIMARY (hardware UART) and PORT_SECONDARY (PD5). PORT_COUNTER only
+// counts bytes, the benchmark uses it to measure the output profiles.
+struct {
+  uint8_t split;
+  uint8_t low;
+  uint8_t high;
+  uint8_t control;
+} route = { KEY_COUNT, PORT_PRIMARY, PORT_PRIMARY, PORT_PRIMARY };
+
+// Every port has an output profile shaping the messages for the receiver on
+// it. Selecting a profile compiles its SHAPE_* options into a short program
+// per event type, so sending a message runs that program and never looks at
+// the options again.
+typedef enum {
+  OUTPUT_GENERIC,   // status byte on every message, note-off as velocity 0
+  OUTPUT_COMPACT,   // running status
+  OUTPUT_NOTE_OFF,  // 0x80 note-offs with release velocity
+  OUTPUT_HIGH_RES,  // 0x80 note-offs, note-ons preceded by CC#88
+  OUTPUT_PROFILES
+} output_profile_t;
+
+const uint8_t output_shapes[] PROGMEM = {
+  0,
+  SHAPE_RUNNING,
+  SHAPE_NOTE_OFF,
+  SHAPE_NOTE_OFF | SHAPE_HIGH_RES
+};
+
+typedef enum {
+  EVENT_NOTE_ON,
+  EVENT_NOTE_OFF,
+  EVENT_CONTROL,
+  EVENT_PROGRAM,
+  EVENT_TYPES
+} event_t;
+
+// OP_STATUS and OP_RUNNING take the status byte as operand, OP_RUNNING
+// leaves it out if the port already runs on it; OP_CONST takes a data byte.
+typedef enum {
+  OP_END,
+  OP_STATUS,
+  OP_RUNNING,
+  OP_CONST,
+  OP_DATA1,
+  OP_DATA2,
+  OP_FINE
+} op_t;
+
+typedef struct {
+  uint8_t profile;
+  uint8_t running;
+  uint8_t entry[EVENT_TYPES];
+  uint8_t ops[ENCODER_OPS];
+} encoder_t;
+
+encoder_t encoders[MIDI_PORTS];
+uint16_t  midi_counted;
+bool      midi_high_res;
+
+// Profiles stored with the SysEx command, loaded at boot.
+uint8_t EEMEM stored_profiles[2];
+
+inline void encoder_compile(uint8_t port, uint8_t profile)
+{
+  encoder_t *encoder = &encoders[port];
+  uint8_t shape = pgm_read_byte(&output_shapes[profile]);
+  uint8_t status = shape & SHAPE_RUNNING ? OP_RUNNING : OP_STATUS;
+  uint8_t *op = encoder->ops;
+
+  encoder->profile = profile;
+  encoder->running = 0;
+
+  encoder->entry[EVENT_NOTE_ON] = op - encoder->ops;
+  if(shape & SHAPE_HIGH_RES) {
+    *op++ = status; *op++ = MIDI_CONTROL;
+    *op++ = OP_CONST; *op++ = MIDI_HIGH_RES;
+    *op++ = OP_FINE;
+  }
+  *op++ = status; *op++ = MIDI_NOTE_ON;
+  *op++ = OP_DATA1; *op++ = OP_DATA2; *op++ = OP_END;
+
+  encoder->entry[EVENT_NOTE_OFF] = op - encoder->ops;
+  if(shape & SHAPE_NOTE_OFF) {
+    *op++ = status; *op++ = MIDI_NOTE_OFF;
+    *op++ = OP_DATA1; *op++ = OP_CONST; *op++ = MIDI_RELEASE; *op++ = OP_END;
+  } else {
+    *op++ = status; *op++ = MIDI_NOTE_ON;
+    *op++ = OP_DATA1; *op++ = OP_CONST; *op++ = 0x00; *op++ = OP_END;
+  }
+
+  encoder->entry[EVENT_CONTROL] = op - encoder->ops;
+  *op++ = status; *op++ = MIDI_CONTROL;
+  *op++ = OP_DATA1; *op++ = OP_DATA2; *op++ = OP_END;
+
+  encoder->entry[EVENT_PROGRAM] = op - encoder->ops;
+  *op++ = status; *op++ = MIDI_PROGRAM;
+  *op++ = OP_DATA1; *op++ = OP_END;
+
+  // the fine velocity is only worked out if a live port sends it
+  midi_high_res = false;
+  for(uint8_t i = 0; i < MIDI_PORTS - 1; ++i) {
+    midi_high_res |= pgm_read_byte(&output_shapes[encoders[i].profile]) & SHAPE_HIGH_RES;
+  }
+}
+
+inline void midi_init()
+{
+  for(uint8_t port = 0; port < MIDI_PORTS - 1; ++port) {
+    uint8_t profile = eeprom_read_byte(&stored_profiles[port]);
+    encoder_compile(port, profile < OUTPUT_PROFILES ? profile : OUTPUT_GENERIC);
+  }
+  encoder_compile(MIDI_PORTS - 1, OUTPUT_GENERIC);
+}
+
+// Free space in the fuller of the two transmit queues.
+inline uint8_t midi_room()
+{
+  return min(uart_room(), soft_uart_room());
+}
+
+inline void midi_write(uint8_t port, uint8_t byte)
+{
+  switch(port) {
+    case 0:
+      uart_putc(byte);
+      break;
+    case 1:
+      soft_uart_putc(byte);
+      break;
+    default:
+      midi_counted++;
+      break;
+  }
+}
+
+PROFILED inline void midi_encode(uint8_t port, uint8_t event, uint8_t data1,
+  uint8_t data2, uint8_t fine)
+{
+  encoder_t *encoder = &encoders[port];
+  const uint8_t *op = encoder->ops + encoder->entry[event];
+  uint8_t byte;
+
+  for(;;) {
+    switch(*op++) {
+      case OP_END:
+        return;
+      case OP_RUNNING:
+        byte = *op++;
+        if(byte == encoder->running) {
+          continue;
+        }
+        encoder->running = byte;
+        break;
+      case OP_STATUS:
+      case OP_CONST:
+        byte = *op++;
+        break;
+      case OP_DATA1:
+        byte = data1;
+        break;
+      case OP_DATA2:
+        byte = data2;
+        break;
+      default:
+        byte = fine;
+        break;
+    }
+    midi_write(port, byte);
+  }
+}
+
+inline void midi_event(uint8_t ports, uint8_t event, uint8_t data1,
+  uint8_t data2, uint8_t fine)
+{
+  for(uint8_t port = 0; port < MIDI_PORTS; ++port) {
+    if(ports & _BV(port)) {
+      midi_encode(port, event, data1, data2, fine);
+    }
+  }
+}
+
+inline uint8_t midi_note_ports(uint8_t note)
+{
+  return note - MIDI_A0 < route.split ? route.low : route.high;
+}
+
+inline void midi_note_on(uint8_t note, uint8_t velocity, uint8_t fine)
+{
+  midi_event(midi_note_ports(note), EVENT_NOTE_ON, note, velocity, fine);
+}
+
+inline void midi_note_off(uint8_t note)
+{
+  midi_event(midi_note_ports(note), EVENT_NOTE_OFF, note, 0, 0);
+}
+
+inline void midi_program(uint8_t program)
+{
+  midi_event(route.control, EVENT_PROGRAM, program, 0, 0);
+}
+
+inline void midi_control(uint8_t control, uint8_t value)
+{
+  midi_event(route.control, EVENT_CONTROL, control, value, 0);
+}
+
+//// OUTPUT ////
+
+// While the sustain pedal is held a note-off has no audible effect, so it is
+// only marked here and sent when the link is otherwise idle. Once the pedal
+// is up the rest drain within the output budget and the sustain-off follows
+// them. A key struck again in the meantime gets its note-off first, so
+// receivers never see two note-ons in a row.
+uint8_t  deferred[(KEY_COUNT + 7) / 8];
+uint8_t  deferred_count;
+bool     sustain_held;
+uint8_t  pass_note_ons;
+
+// The self-benchmark mutes the output: events are counted and encoded for
+// PORT_COUNTER only.
+bool     output_muted;
+uint16_t output_events;
+
+inline void output_note_on(uint8_t key, uint8_t velocity, uint8_t fine)
+{
+  uint8_t mask = _BV(key & 0b111);
+
+  if(output_muted) {
+    output_events++;
+    midi_event(PORT_COUNTER, EVENT_NOTE_ON, KEY_NOTE(key), velocity, fine);
+    return;
+  }
+
+  if(deferred[key >> 3] & mask) {
+    deferred[key >> 3] &= ~mask;
+    deferred_count--;
+    midi_note_off(KEY_NOTE(key));
+  }
+
+  midi_note_on(KEY_NOTE(key), velocity, fine);
+  pass_note_ons++;
+}
+
+inline void output_note_off(uint8_t key)
+{
+  uint8_t mask = _BV(key & 0b111);
+
+  if(output_muted) {
+    output_events++;
+    midi_event(PORT_COUNTER, EVENT_NOTE_OFF, KEY_NOTE(key), 0, 0);
+    return;
+  }
+
+  if(!sustain_held) {
+    midi_note_off(KEY_NOTE(key));
+  } else if(!(deferred[key >> 3] & mask)) {
+    deferred[key >> 3] |= mask;
+    deferred_count++;
+  }
+}
+
+// True if a key event can be sent without waiting for the transmitter. A
+// note-on may carry the deferred note-off of its key and a CC#88, hence
+// OUTPUT_EVENT_SIZE is three messages.
+inline bool output_room()
+{
+  return output_muted || midi_room() >= OUTPUT_EVENT_SIZE;
+}
+
+// Sends up to limit deferred note-offs in key order, as long as there is room
+// for them, and returns what is left of the limit.
+inline uint8_t output_release_deferred(uint8_t limit)
+{
+  for(uint8_t key = 0; deferred_count && limit && output_room(); ++key) {
+    uint8_t mask = _BV(key & 0b111);
+    if(deferred[key >> 3] & mask) {
+      deferred[key >> 3] &= ~mask;
+      deferred_count--;
+      limit--;
+      midi_note_off(KEY_NOTE(key));
+    }
+  }
+
+  return limit;
+}
+
+// Called once per pass with what is left of the output budget. With the
+// sustain pedal up the deferred note-offs take all of it, while it is held
+// a pass without note-ons has room for one of them.
+PROFILED inline void output_pass_done(uint8_t budget)
+{
+  if(!sustain_held) {
+    output_release_deferred(budget);
+  } else if(!pass_note_ons && budget) {
+    output_release_deferred(1);
+  }
+  pass_note_ons = 0;
+}
+
+//// PEDALS ////
+
+// Pedal edges are accepted as soon as they are seen and timestamped with
+// timer1; every further change within PEDAL_DEBOUNCE ticks (~10 ms) is
+// bounce. Once the window has passed, the pin is compared with the accepted
+// state again, so a pedal that settled the other way is still reported. The
+// inputs are active low: a pedal is pressed while its pin reads low.
+//
+// The sustain pedal sits on INT1 and is captured by interrupt. The soft pedal
+// on PD4 has no external interrupt on the ATmega16 and is polled once per pass
+// through the same debounce; routing it to INT0 (PD2) or INT2 (PB2) on a
+// future board would only need irq set and a second handler.
+typedef struct {
+  uint8_t  pin;
+  uint8_t  control;
+  bool     irq;
+  bool     locked;
+  bool     pressed;
+  uint16_t changed_at;
+} pedal_t;
+
+typedef struct {
+  uint8_t control;
+  uint8_t value;
+} pedal_event_t;
+
+pedal_t pedals[] = {
+  { SUSTAIN_PEDAL, MIDI_SUSTAIN_PEDAL, true },
+  { SOFT_PEDAL,    MIDI_SOFT_PEDAL,    false }
+};
+
+pedal_event_t    pedal_queue[PEDAL_QUEUE_SIZE];
+volatile uint8_t pedal_head;
+volatile uint8_t pedal_tail;
+
+inline void pedal_sample(pedal_t *pedal, uint16_t now)
+{
+  if(pedal->locked) {
+    if((uint16_t)(now - pedal->changed_at) < PEDAL_DEBOUNCE) {
+      return;
+    }
+    pedal->locked = false;
+  }
+
+  bool    pressed = !(PIND & _BV(pedal->pin));
+  uint8_t head = (pedal_head + 1) % PEDAL_QUEUE_SIZE;
+
+  if(pressed == pedal->pressed) {
+    return;
+  }
+
+  // with the queue full the pedal stays locked, so pedals_update polls it
+  // until the edge fits
+  if(head == pedal_tail) {
+    pedal->locked = true;
+    return;
+  }
+
+  pedal->pressed = pressed;
+  pedal->changed_at = now;
+  pedal->locked = true;
+
+  pedal_event_t *event = &pedal_queue[pedal_head];
+  event->control = pedal->control;
+  event->value = pressed ? 0x40 : 0x00;
+  pedal_head = head;
+}
+
+ISR(INT1_vect)
+{
+  pedal_sample(&pedals[0], TCNT1);
+}
+
+inline void pedals_init()
+{
+  for(uint8_t i = 0; i < sizeof(pedals) / sizeof(pedals[0]); ++i) {
+    pedals[i].pressed = !(PIND & _BV(pedals[i].pin));
+  }
+
+  // INT1 on any logical change of the sustain pedal
+  MCUCR |= _BV(ISC10);
+  GIFR = _BV(INTF1);
+  GICR |= _BV(INT1);
+}
+
+// Polls the pedals without an interrupt and closes expired debounce windows.
+PROFILED inline void pedals_update()
+{
+  for(uint8_t i = 0; i < sizeof(pedals) / sizeof(pedals[0]); ++i) {
+    if(pedals[i].irq && !pedals[i].locked) {
+      continue;
+    }
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+      pedal_sample(&pedals[i], TCNT1);
+    }
+  }
+}
+
+PROFILED inline void pedals_flush()
+{
+  while(pedal_tail != pedal_head) {
+    pedal_event_t *event = &pedal_queue[pedal_tail];
+    if(event->control == MIDI_SUSTAIN_PEDAL) {
+      // 0x40 while the pedal is pressed, see pedal_sample
+      sustain_held = event->value >= 0x40;
+      // the sustain-off waits in the queue for the deferred note-offs,
+      // which drain in output_pass_done
+      if(!sustain_held && deferred_count) {
+        return;
+      }
+    }
+    midi_control(event->control, event->value);
+    pedal_tail = (pedal_tail + 1) % PEDAL_QUEUE_SIZE;
+  }
+}
+
+//// VELOCITY ////
+
+// The velocity curve is given by a handful of parameters and expanded into
+// an inverse threshold table: curve[k] is the last touch duration (in timer1
+// ticks) that still yields velocity max - k. Up to knee ticks a stroke gets
+// max, slower strokes get max * (knee / duration) ^ (1 / gamma) down to min,
+// which is also used from range on. gamma is in 1/16. The defaults match the
+// fixed table the firmware used to ship.
+struct {
+  uint8_t  gamma;
+  uint8_t  min;
+  uint8_t  max;
+  uint8_t  knee;
+  uint16_t range;
+} curve_params = { CURVE_GAMMA, CURVE_MIN, CURVE_MAX, CURVE_KNEE, CURVE_RANGE };
+
+// The factory test keeps its records in place of the table, see TEST.
+static union {
+  uint16_t curve[128];
+  struct {
+    uint16_t duration[KEY_COUNT + 8];
+    uint8_t  bounce[(KEY_COUNT + 8) / 2];
+  } test_record;
+};
+uint16_t curve_ticks;
+
+// Takes a few tens of milliseconds of floating point, at boot and whenever the
+// curve is changed; curve_ticks holds how long the last expansion took.
+inline void curve_expand()
+{
+  uint16_t start = TCNT1;
+  uint8_t  steps = curve_params.max - curve_params.min;
+  double   gamma = curve_params.gamma / 16.0;
+
+  for(uint8_t k = 0; k < 128; ++k) {
+    if(k >= steps) {
+      curve[k] = 0xffff;
+      continue;
+    }
+    // duration at which the curve crosses halfway to the next velocity
+    // clamped before rounding, steep curves overflow what lround returns
+    double duration = curve_params.knee * pow(curve_params.max / (curve_params.max - k - 0.5), gamma);
+    curve[k] = lround(min(duration, (double)curve_params.range)) - 1;
+  }
+
+  curve_ticks = TCNT1 - start;
+}
+
+// Seven branchless halving steps over the 128 thresholds count how many of
+// them the duration exceeds.
+PROFILED inline uint8_t velocity_lookup(uint16_t touch_duration)
+{
+  uint8_t i = 0;
+
+  for(uint8_t step = 64; step; step >>= 1) {
+    i += step & -(uint8_t)(curve[i + step - 1] < touch_duration);
+  }
+
+  return curve_params.max - i;
+}
+
+// Position of the duration within the thresholds of its velocity, as the
+// 7-bit fraction sent in CC#88: 0x7f at the fast end, 0 at the slow end and
+// for everything at or below min.
+PROFILED inline uint8_t velocity_fine(uint16_t touch_duration, uint8_t velocity)
+{
+  uint8_t  i = curve_params.max - velocity;
+  uint16_t low = i ? curve[i - 1] : 0;
+  uint16_t high = curve[i];
+
+  if(!midi_high_res || high == 0xffff || high <= low) {
+    return 0;
+  }
+
+  return (uint32_t)(high - touch_duration) * 0x7f / (high - low);
+}
+
+//// SCAN ////
+
+uint16_t stateA[CHANNELS], stateB[CHANNELS];
+uint16_t timers[KEY_COUNT];
+
+// Key events are detected and timestamped in every pass, but at most
+// OUTPUT_BUDGET of them are sent per pass, and only while the transmit
+// queues have room, so a forearm on the keys cannot stretch a pass; the rest
+// is marked here and sent in later passes. The touch duration of a pending
+// note-on is kept in its key timer, which is not restamped until the note-on
+// is sent, and turned into a velocity when sent. A key has at most a
+// note-on and a note-off pending: a note-off that finds both pending (off,
+// on, off) replaces them, and a key struck again before its last stroke
+// went out drops that stroke, which the receiver never saw. Both pending
+// means the note-on comes first if the key is back at rest, else the
+// note-off.
+uint16_t pending_on[CHANNELS], pending_off[CHANNELS];
+uint8_t  drain_chan;
+
+inline void scan_init()
+{
+  // all keys released
+  for(uint8_t chan = 0; chan < CHANNELS; chan++) {
+    stateA[chan] = stateB[chan] = 0xffff;
+    pending_on[chan] = pending_off[chan] = 0;
+  }
+}
+
+inline void scan_emit(uint8_t chan, uint8_t line)
+{
+  uint16_t mask = (uint16_t)1 << line;
+  uint16_t first_on = ~pending_off[chan] | (stateA[chan] & stateB[chan]);
+  uint8_t key = KEY_INDEX(chan, line);
+
+  if(pending_on[chan] & first_on & mask) {
+    pending_on[chan] &= ~mask;
+    uint8_t velocity = velocity_lookup(timers[key]);
+    output_note_on(key, velocity, velocity_fine(timers[key], velocity));
+  } else {
+    pending_off[chan] &= ~mask;
+    output_note_off(key);
+  }
+}
+
+// Sends all pending events of a channel regardless of the budget.
+inline void scan_flush(uint8_t chan)
+{
+  for(uint8_t line = 0; line < 16; line++) {
+    while((pending_on[chan] | pending_off[chan]) >> line & 1) {
+      scan_emit(chan, line);
+    }
+  }
+}
+
+// Keys starting a press drop a stroke still pending, see above.
+inline void scan_drop(uint8_t chan, uint16_t press)
+{
+  press &= pending_on[chan];
+  pending_on[chan] &= ~press;
+  pending_off[chan] &= ~press;
+}
+
+inline void scan_queue(uint8_t chan, uint16_t note_on, uint16_t note_off)
+{
+  pending_on[chan] &= ~(note_off & pending_off[chan]);
+  pending_on[chan] |= note_on;
+  pending_off[chan] |= note_off;
+}
+
+// Sends up to budget pending events, channel by channel, and returns what is
+// left of the budget.
+PROFILED inline uint8_t scan_drain(uint8_t budget)
+{
+  for(uint8_t idle = 0; budget && idle < CHANNELS && output_room(); ) {
+    uint16_t lines = pending_on[drain_chan] | pending_off[drain_chan];
+    uint8_t line = 0;
+
+    if(!lines) {
+      drain_chan = (drain_chan + 1) % CHANNELS;
+      idle++;
+      continue;
+    }
+
+    while(!(lines & 1)) {
+      lines >>= 1;
+      line++;
+    }
+
+    scan_emit(drain_chan, line);
+    budget--;
+    idle = 0;
+  }
+
+  return budget;
+}
+
+// Each mux sample carries its own timestamp, taken once its row has settled.
+// Channels at odd scan positions read B first, the others A (see
+// channel_addr), so the second sample follows the first by that row's settle
+// time, 30 us with the default SETTLE_US, a noticeable share of a fast stroke.
+// B is the first contact to close, A the second, so a press starts at the B
+// sample and its note-on happens at the A sample. Transitions caused by A
+// are stamped with timestampA, all others with timestampB; when both close
+// within one pass the stroke is timed from A and counts as the fastest.
+PROFILED inline void scan_channel(uint8_t chan, uint16_t inputA, uint16_t inputB,
+  uint16_t timestampA, uint16_t timestampB)
+{
+  uint16_t timer, timerA, timerB, note_on, note_off;
+
+  // time measurements
+  timer = (stateA[chan] ^ ~stateB[chan]) & (inputA ^ inputB | stateA[chan] ^ inputA);
+
+  // a pending note-on keeps its duration in the timer
+  scan_drop(chan, timer & stateB[chan]);
+  timer &= ~pending_on[chan];
+  timerA = timer & (stateA[chan] ^ inputA);
+  timerB = timer & ~timerA;
+
+  for_set_bits(line, timerA) {
+    timers[KEY_INDEX(chan, line)] = timestampA;
+  }
+
+  for_set_bits(line, timerB) {
+    timers[KEY_INDEX(chan, line)] = timestampB;
+  }
+
+  // queue notes
+  note_on = stateB[chan] & ~inputA & ~inputB;
+  note_off = ~stateB[chan] & inputA & inputB;
+
+  scan_queue(chan, note_on, note_off);
+
+  for_set_bits(line, note_on) {
+    uint8_t key = KEY_INDEX(chan, line);
+    timers[key] = timestampA - timers[key];
+  }
+
+  // update states
+  stateA[chan] = inputB | (~stateB[chan] & inputA);
+  stateB[chan] = stateA[chan] ^ inputA ^ inputB;
+}
+
+#ifdef PASS_TIMING
+
+// Alternative timing engine without timestamps: every key in flight counts
+// scan passes, and the main loop runs passes at a fixed rate of PASS_TICKS,
+// so a count of n is a touch duration of n * PASS_TICKS ticks. The counters
+// are bit-sliced: plane b of a channel holds bit b of the counters of all
+// its lines, so one ripple carry over PASS_PLANES words advances the whole
+// channel and nothing is written per key until its note-on. Counters stop
+// at 2^PASS_PLANES - 1, which covers the curve range. Resolution is one pass
+// instead of one tick, and A and B closing in the same pass are not told
+// apart. A pass is PASS_SETTLE_US of mux settle time plus PASS_WORK_US for
+// everything else, SET_SETTLE refuses settle times that add up to more.
+uint16_t pass_planes[CHANNELS][PASS_PLANES];
+
+inline uint16_t pass_count(uint8_t chan, uint8_t line)
+{
+  uint16_t count = 0;
+
+  for(uint8_t b = PASS_PLANES; b--; ) {
+    count = (count << 1) | ((pass_planes[chan][b] >> line) & 1);
+  }
+
+  return count;
+}
+
+PROFILED inline void scan_channel_passes(uint8_t chan, uint16_t inputA, uint16_t inputB)
+{
+  uint16_t *planes = pass_planes[chan];
+  uint16_t carry, timer, note_on, note_off;
+
+  // one more pass for every key in flight, counters that overflow are set
+  // back to all ones
+  carry = stateA[chan] ^ stateB[chan];
+
+  for(uint8_t b = 0; b < PASS_PLANES; ++b) {
+    uint16_t next = planes[b] & carry;
+    planes[b] ^= carry;
+    carry = next;
+  }
+
+  for(uint8_t b = 0; b < PASS_PLANES; ++b) {
+    planes[b] |= carry;
+  }
+
+  // keys starting to move count from zero
+  timer = (stateA[chan] ^ ~stateB[chan]) & (inputA ^ inputB | stateA[chan] ^ inputA);
+
+  scan_drop(chan, timer & stateB[chan]);
 
-#define KEY_INDEX(CHANNEL, LINE) (((LINE) >> 3) * 0x28 + ((CHANNEL) << 3) + ((LINE) & 0b111))
+  for(uint8_t b = 0; b < PASS_PLANES; ++b) {
+    planes[b] &= ~timer;
+  }
 
-#define MIDI_KEY(CHANNEL, LINE) (MIDI_A0 + KEY_INDEX(CHANNEL, LINE))
+  // queue notes
+  note_on = stateB[chan] & ~inputA & ~inputB;
+  note_off = ~stateB[chan] & inputA & inputB;
 
-#define READ_LINES(CHANNEL, VAR) \
-  PORTB = channel_addr[(CHANNEL)]; \
-  _delay_us(30); \
-  VAR = (PINC << 8) | PINA;
+  scan_queue(chan, note_on, note_off);
+
+  for_set_bits(line, note_on) {
+    timers[KEY_INDEX(chan, line)] = pass_count(chan, line) * PASS_TICKS;
+  }
+
+  // update states
+  stateA[chan] = inputB | (~stateB[chan] & inputA);
+  stateB[chan] = stateA[chan] ^ inputA ^ inputB;
+}
+
+#endif
+
+// The timing engine the firmware is built with.
+inline void scan_live(uint8_t chan, uint16_t inputA, uint16_t inputB,
+  uint16_t timestampA, uint16_t timestampB)
+{
+#ifdef PASS_TIMING
+  scan_channel_passes(chan, inputA, inputB);
+#else
+  scan_channel(chan, inputA, inputB, timestampA, timestampB);
+#endif
+}
+
+//// SYSEX ////
+
+typedef enum {
+  STATE_IDLE,
+  STATE_MATCHING_HEADER,
+  STATE_READING_BODY,
+  STATE_EXPECTING_END
+} state_t;
+
+typedef enum {
+  COMMAND_PROFILE_START = 0x30,
+  COMMAND_PROFILE_STOP  = 0x31,
+  COMMAND_PROFILE_DUMP  = 0x32,
+  COMMAND_SET_ROUTING   = 0x33,
+  COMMAND_BENCHMARK     = 0x34,
+  COMMAND_SET_CURVE     = 0x35,
+  COMMAND_GET_CURVE     = 0x36,
+  COMMAND_SET_OUTPUT    = 0x37,
+  COMMAND_SET_SETTLE    = 0x38,
+  COMMAND_TEST_START    = 0x39,
+  COMMAND_TEST_DUMP     = 0x3a,
+  COMMAND_TEST_STOP     = 0x3b,
+
+  REPLY_SUCCESS         = 0x20,
+  REPLY_ERROR           = 0x21,
+  REPLY_PROFILE         = 0x40,
+  REPLY_BENCHMARK       = 0x41,
+  REPLY_CURVE           = 0x42,
+  REPLY_ENCODING        = 0x43,
+  REPLY_TEST            = 0x44
+} command_t;
+
+typedef enum {
+  ERROR_NONE,
+  ERROR_HEADER_MISMATCH,
+  ERROR_INVALID_FORMAT,
+  ERROR_INCOMPLETE_MESSAGE,
+  ERROR_INVALID_NIBBLE,
+  ERROR_INVALID_CHECKSUM,
+  ERROR_UNKNOWN_COMMAND,
+  ERROR_INVALID_PAYLOAD_SIZE,
+  ERROR_INVALID_PARAMETER = 0x10,
+  ERROR_TEST_ACTIVE
+} error_t;
+
+typedef struct {
+  uint8_t header[3];
+  union {
+    struct {
+      uint8_t command;
+      union {
+        uint8_t checksum;
+        uint8_t params[MSG_PARAMS_SIZE];
+      };
+    };
+    uint8_t buffer[MSG_PARAMS_SIZE + sizeof(command) + 1];
+  };
+} message_t;
+
+// The receiver runs in the UART interrupt and only assembles the message;
+// replies are sent from the main loop between two scan passes, so they
+// never interleave with note output.
+message_t         msg;
+volatile uint8_t  msg_status;
+uint8_t           payload_size;
+
+// A message is sent in parts, so a long reply can be produced piece by piece
+// instead of being assembled on the stack first.
+uint8_t           send_checksum;
+
+inline void send_begin(uint8_t command)
+{
+  uart_putc(0xf0);
+
+  for(uint8_t i = 0; i < sizeof(msg.header); ++i) {
+    uart_putc(msg.header[i]);
+  }
+
+  uart_putc(command >> 4);
+  uart_putc(command & 0x0f);
+  send_checksum = command;
+}
+
+inline void send_byte(uint8_t byte)
+{
+  uart_putc(byte >> 4);
+  uart_putc(byte & 0x0f);
+  send_checksum ^= byte;
+}
+
+inline void send_params(const void *params, uint8_t params_size)
+{
+  const uint8_t *buffer = (const uint8_t*)params;
+
+  for(uint8_t i = 0; i < params_size; ++i) {
+    send_byte(buffer[i]);
+  }
+}
+
+inline void send_end()
+{
+  uart_putc(send_checksum >> 4);
+  uart_putc(send_checksum & 0x0f);
+
+  uart_putc(0xf7);
+
+  // the receiver drops running status on SysEx
+  encoders[0].running = 0;
+}
+
+inline void send_msg(uint8_t command, const void *params, uint8_t params_size)
+{
+  send_begin(command);
+  send_params(params, params_size);
+  send_end();
+}
+
+inline void reply_success()
+{
+  send_msg(REPLY_SUCCESS, 0, 0);
+}
+
+inline void reply_error(uint8_t error)
+{
+  send_msg(REPLY_ERROR, &error, sizeof(error));
+}
+
+inline void reply_data(command_t command, const void *data, uint8_t data_size)
+{
+  send_msg(command, data, data_size);
+}
+
+inline void sysex_init()
+{
+  msg.header[0] = 0x00;
+  msg.header[1] = MIDI_ID;
+  msg.header[2] = VERSION;
+
+  msg_status = MSG_EMPTY;
+
+  UCSRB |= _BV(RXCIE);
+}
+
+ISR(USART_RXC_vect)
+{
+  static state_t  state;
+  static uint8_t  checksum;
+  static uint16_t bytes_read;
+
+  uint8_t byte = UDR;
+
+  // drop everything until the main loop has handled the last message
+  if(msg_status != MSG_EMPTY) {
+    return;
+  }
+
+  if(byte < 0x80) {
+    switch(state) {
+      case STATE_MATCHING_HEADER:
+        if(byte != msg.header[bytes_read++]) {
+          msg_status = ERROR_HEADER_MISMATCH;
+          state = STATE_IDLE;
+        } else if(bytes_read == sizeof(msg.header)) {
+          state = STATE_READING_BODY;
+          bytes_read = 0;
+        }
+        break;
+
+      case STATE_READING_BODY:
+        if(byte > 0xf) {
+          msg_status = ERROR_INVALID_NIBBLE;
+          state = STATE_IDLE;
+          break;
+        }
+        if(bytes_read++ & 1) {
+          msg.buffer[payload_size] += byte;
+          checksum ^= msg.buffer[payload_size++];
+        } else {
+          msg.buffer[payload_size] = byte << 4;
+        }
+        if(payload_size == sizeof(msg.buffer)) {
+          state = STATE_EXPECTING_END;
+        }
+        break;
+
+      case STATE_EXPECTING_END:
+        msg_status = ERROR_INVALID_PAYLOAD_SIZE;
+        state = STATE_IDLE;
+        break;
+    }
+  } else if(byte == 0xf0) {
+    if(state != STATE_IDLE) {
+      msg_status = ERROR_INCOMPLETE_MESSAGE;
+    }
+    state = STATE_MATCHING_HEADER;
+    checksum = 0;
+    bytes_read = 0;
+    payload_size = 0;
+  } else if(byte == 0xf7) {
+    if(state != STATE_IDLE) {
+      if(state < STATE_READING_BODY || payload_size <= sizeof(msg.command)) {
+        msg_status = ERROR_INVALID_FORMAT;
+      } else if(checksum) {
+        msg_status = ERROR_INVALID_CHECKSUM;
+      } else {
+        payload_size -= sizeof(msg.command) + sizeof(checksum);
+        msg_status = ERROR_NONE;
+      }
+      state = STATE_IDLE;
+    }
+  }
+}
+
+//// PROFILER ////
+
+#ifdef PROFILER
+
+// Statistical PC sampler: timer0 interrupts the program every
+// (PROFILE_PERIOD + 1) * 64 us (CTC counts up to and including OCR0) and
+// counts the interrupted (word) address in one of PROFILE_BUCKETS buckets of
+// 2^shift words starting at base. Addresses outside that window are counted in
+// other. The host maps buckets back to symbols.
+struct {
+  uint16_t base;
+  uint8_t  shift;
+  uint16_t other;
+  uint16_t buckets[PROFILE_BUCKETS];
+} profile;
+
+extern "C" void profile_sample(uint16_t pc) __attribute__ ((used));
+extern "C" void profile_sample(uint16_t pc)
+{
+  uint16_t bucket = (pc - profile.base) >> profile.shift;
+  uint16_t *counter = &profile.other;
+
+  if(pc >= profile.base && bucket < PROFILE_BUCKETS) {
+    counter = &profile.buckets[bucket];
+  }
+  if(*counter != 0xffff) {
+    ++*counter;
+  }
+}
+
+// The return address is only reachable from a naked handler: save everything
+// the call to profile_sample may clobber, then pick the interrupted PC (high
+// byte first) from above the 15 saved registers.
+ISR(TIMER0_COMP_vect, ISR_NAKED)
+{
+  asm volatile (
+      "push r0"                 "\n\t"
+      "in   r0, __SREG__"       "\n\t"
+      "push r0"                 "\n\t"
+      "push r1"                 "\n\t"
+      "clr  __zero_reg__"       "\n\t"
+      "push r18"                "\n\t"
+      "push r19"                "\n\t"
+      "push r20"                "\n\t"
+      "push r21"                "\n\t"
+      "push r22"                "\n\t"
+      "push r23"                "\n\t"
+      "push r24"                "\n\t"
+      "push r25"                "\n\t"
+      "push r26"                "\n\t"
+      "push r27"                "\n\t"
+      "push r30"                "\n\t"
+      "push r31"                "\n\t"
+      "in   r30, __SP_L__"      "\n\t"
+      "in   r31, __SP_H__"      "\n\t"
+      "ldd  r25, Z+16"          "\n\t"
+      "ldd  r24, Z+17"          "\n\t"
+      "call profile_sample"     "\n\t"
+      "pop  r31"                "\n\t"
+      "pop  r30"                "\n\t"
+      "pop  r27"                "\n\t"
+      "pop  r26"                "\n\t"
+      "pop  r25"                "\n\t"
+      "pop  r24"                "\n\t"
+      "pop  r23"                "\n\t"
+      "pop  r22"                "\n\t"
+      "pop  r21"                "\n\t"
+      "pop  r20"                "\n\t"
+      "pop  r19"                "\n\t"
+      "pop  r18"                "\n\t"
+      "pop  r1"                 "\n\t"
+      "pop  r0"                 "\n\t"
+      "out  __SREG__, r0"       "\n\t"
+      "pop  r0"                 "\n\t"
+      "reti"
+  );
+}
+
+inline void profile_start(uint16_t base, uint8_t shift)
+{
+  TIMSK &= ~_BV(OCIE0);
 
-#define HANDLE_PEDAL(PIN, COMMAND) \
-  if(pedals & _BV(PIN)) { \
-    uart_putc(MIDI_CONTROL); \
-    uart_putc(COMMAND); \
-    uart_putc((stateP & _BV(PIN)) << (6 - (PIN))); \
-    _delay_ms(2); \
+  profile.base = base;
+  profile.shift = shift;
+  profile.other = 0;
+  for(uint8_t i = 0; i < PROFILE_BUCKETS; ++i) {
+    profile.buckets[i] = 0;
   }
 
-const uint8_t channel_addr[] = {
-  0b0000, 0b1000, 0b0100, 0b1100, 0b0010, 0b1010,
-  0b0110, 0b1110, 0b0001, 0b1001, 0b0101, 0b1101
+  // timer0 in CTC mode, pre-scaler 1024
+  OCR0 = PROFILE_PERIOD;
+  TCNT0 = 0;
+  TCCR0 = _BV(WGM01) | _BV(CS02) | _BV(CS00);
+  TIMSK |= _BV(OCIE0);
+}
+
+inline void profile_stop()
+{
+  TIMSK &= ~_BV(OCIE0);
+}
+
+#endif
+
+//// BENCHMARK ////
+
+// Every scan kernel and velocity lookup compiled into the firmware, in the
+// order their results are reported. The main loop calls them inline; the
+// benchmark goes through these out-of-line copies.
+typedef void (*scan_kernel_t)(uint8_t, uint16_t, uint16_t, uint16_t, uint16_t);
+typedef uint8_t (*velocity_kernel_t)(uint16_t);
+
+void scan_kernel_timestamps(uint8_t chan, uint16_t inputA, uint16_t inputB,
+  uint16_t timestampA, uint16_t timestampB)
+{
+  scan_channel(chan, inputA, inputB, timestampA, timestampB);
+}
+
+#ifdef PASS_TIMING
+void scan_kernel_passes(uint8_t chan, uint16_t inputA, uint16_t inputB,
+  uint16_t timestampA, uint16_t timestampB)
+{
+  scan_channel_passes(chan, inputA, inputB);
+}
+#endif
+
+uint8_t velocity_kernel_search(uint16_t touch_duration)
+{
+  return velocity_lookup(touch_duration);
+}
+
+const scan_kernel_t scan_kernels[] PROGMEM = {
+  scan_kernel_timestamps,
+#ifdef PASS_TIMING
+  scan_kernel_passes
+#endif
+};
+
+const velocity_kernel_t velocity_kernels[] PROGMEM = {
+  velocity_kernel_search
 };
 
-const uint8_t velocities[] PROGMEM = {
-  0x7f, 0x7f, 0x7f, 0x7f, 0x7f, 0x7f, 0x7f, 0x7f, 0x7f, 0x7f, 0x7f, 0x7f, 0x7f, 0x7f, 0x7f, 0x7f,
-  0x7f, 0x7f, 0x7f, 0x7f, 0x7f, 0x7f, 0x7f, 0x7f, 0x7f, 0x7f, 0x7f, 0x7f, 0x7f, 0x7f, 0x7f, 0x7e,
-  0x7d, 0x7b, 0x7a, 0x78, 0x77, 0x75, 0x74, 0x73, 0x72, 0x71, 0x70, 0x6f, 0x6e, 0x6d, 0x6c, 0x6b,
-  0x6a, 0x69, 0x68, 0x67, 0x66, 0x66, 0x65, 0x64, 0x63, 0x63, 0x62, 0x61, 0x61, 0x60, 0x5f, 0x5f,
-  0x5e, 0x5e, 0x5d, 0x5d, 0x5c, 0x5b, 0x5b, 0x5a, 0x5a, 0x59, 0x59, 0x58, 0x58, 0x57, 0x57, 0x57,
-  0x56, 0x56, 0x55, 0x55, 0x54, 0x54, 0x54, 0x53, 0x53, 0x53, 0x52, 0x52, 0x51, 0x51, 0x51, 0x50,
-  0x50, 0x50, 0x4f, 0x4f, 0x4f, 0x4e, 0x4e, 0x4e, 0x4e, 0x4d, 0x4d, 0x4d, 0x4c, 0x4c, 0x4c, 0x4c,
-  0x4b, 0x4b, 0x4b, 0x4a, 0x4a, 0x4a, 0x4a, 0x49, 0x49, 0x49, 0x49, 0x48, 0x48, 0x48, 0x48, 0x48,
-  0x47, 0x47, 0x47, 0x47, 0x46, 0x46, 0x46, 0x46, 0x46, 0x45, 0x45, 0x45, 0x45, 0x45, 0x44, 0x44,
-  0x44, 0x44, 0x44, 0x43, 0x43, 0x43, 0x43, 0x43, 0x43, 0x42, 0x42, 0x42, 0x42, 0x42, 0x41, 0x41,
-  0x41, 0x41, 0x41, 0x41, 0x41, 0x40, 0x40, 0x40, 0x40, 0x40, 0x40, 0x3f, 0x3f, 0x3f, 0x3f, 0x3f,
-  0x3f, 0x3f, 0x3e, 0x3e, 0x3e, 0x3e, 0x3e, 0x3e, 0x3e, 0x3d, 0x3d, 0x3d, 0x3d, 0x3d, 0x3d, 0x3d,
-  0x3d, 0x3c, 0x3c, 0x3c, 0x3c, 0x3c, 0x3c, 0x3c, 0x3c, 0x3b, 0x3b, 0x3b, 0x3b, 0x3b, 0x3b, 0x3b,
-  0x3b, 0x3b, 0x3a, 0x3a, 0x3a, 0x3a, 0x3a, 0x3a, 0x3a, 0x3a, 0x3a, 0x39, 0x39, 0x39, 0x39, 0x39,
-  0x39, 0x39, 0x39, 0x39, 0x38, 0x38, 0x38, 0x38, 0x38, 0x38, 0x38, 0x38, 0x38, 0x38, 0x38, 0x37,
-  0x37, 0x37, 0x37, 0x37, 0x37, 0x37, 0x37, 0x37, 0x37, 0x37, 0x36, 0x36, 0x36, 0x36, 0x36, 0x36,
-  0x36, 0x36, 0x36, 0x36, 0x36, 0x35, 0x35, 0x35, 0x35, 0x35, 0x35, 0x35, 0x35, 0x35, 0x35, 0x35, 0x35, 0x35, 0x34, 0x34, 0x34, 0x34, 0x34, 0x34, 0x34, 0x34, 0x34, 0x34, 0x34, 0x34, 0x34, 0x33, 0x33, 0x33, 0x33, 0x33, 0x33, 0x33, 0x33, 0x33, 0x33, 0x33, 0x33, 0x33, 0x33, 0x32, 0x32, 0x32, 0x32, 0x32, 0x32, 0x32, 0x32, 0x32, 0x32, 0x32, 0x32, 0x32, 0x32, 0x32, 0x32, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x31, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x2f, 0x2f, 0x2f, 0x2f, 0x2f, 0x2f, 0x2f, 0x2f, 0x2f, 0x2f, 0x2f, 0x2f, 0x2f, 0x2f, 0x2f, 0x2f, 0x2f, 0x2f, 0x2f, 0x2e, 0x2e, 0x2e, 0x2e, 0x2e, 0x2e, 0x2e, 0x2e, 0x2e, 0x2e, 0x2e, 0x2e, 0x2e, 0x2e, 0x2e, 0x2e, 0x2e, 0x2e, 0x2e, 0x2e, 0x2d, 0x2d, 0x2d, 0x2d, 0x2d, 0x2d, 0x2d, 0x2d, 0x2d, 0x2d, 0x2d, 0x2d, 0x2d, 0x2d, 0x2d, 0x2d, 0x2d, 0x2d, 0x2d, 0x2d, 0x2d, 0x2d, 0x2c, 0x2c, 0x2c, 0x2c, 0x2c, 0x2c, 0x2c, 0x2c, 0x2c, 0x2c, 0x2c, 0x2c, 0x2c, 0x2c, 0x2c, 0x2c, 0x2c, 0x2c, 0x2c, 0x2c, 0x2c, 0x2c, 0x2c, 0x2c, 0x2b, 0x2b, 0x2b, 0x2b, 0x2b, 0x2b, 0x2b, 0x2b, 0x2b, 0x2b, 0x2b, 0x2b, 0x2b, 0x2b, 0x2b, 0x2b, 0x2b, 0x2b, 0x2b, 0x2b, 0x2b, 0x2b, 0x2b, 0x2b, 0x2b, 0x2b, 0x2a, 0x2a, 0x2a, 0x2a, 0x2a, 0x2a, 0x2a, 0x2a, 0x2a, 0x2a, 0x2a, 0x2a, 0x2a, 0x2a, 0x2a, 0x2a, 0x2a, 0x2a, 0x2a, 0x2a, 0x2a, 0x2a, 0x2a, 0x2a, 0x2a, 0x2a, 0x2a, 0x29, 0x29, 0x29, 0x29, 0x29, 0x29, 0x29, 0x29, 0x29, 0x29, 0x29, 0x29, 0x29, 0x29, 0x29, 0x29, 0x29, 0x29, 0x29, 0x29, 0x29, 0x29, 0x29, 0x29, 0x29, 0x29, 0x29, 0x29, 0x29, 0x29, 0x29, 0x28, 0x28, 0x28, 0x28, 0x28, 0x28, 0x28, 0x28, 0x28, 0x28, 0x28, 0x28, 0x28, 0x28, 0x28, 0x28, 0x28, 0x28, 0x28, 0x28, 0x28, 0x28, 0x28, 0x28, 0x28, 0x28, 0x28, 0x28, 0x28, 0x28, 0x28, 0x28, 0x28, 0x27, 0x27, 0x27, 0x27, 0x27, 0x27, 0x27, 0x27, 0x27, 0x27, 0x27, 0x27, 0x27, 0x27, 0x27, 0x27, 0x27, 0x27, 0x27, 0x27, 0x27, 0x27, 0x27, 0x27, 0x27, 0x27, 0x27, 0x27, 0x27, 0x27, 0x27, 0x27, 0x27, 0x27, 0x27, 0x27, 0x26, 0x26, 0x26, 0x26, 0x26, 0x26, 0x26, 0x26, 0x26, 0x26, 0x26, 0x26, 0x26, 0x26, 0x26, 0x26, 0x26, 0x26, 0x26, 0x26, 0x26, 0x26, 0x26, 0x26, 0x26, 0x26, 0x26, 0x26, 0x26, 0x26, 0x26, 0x26, 0x26, 0x26, 0x26, 0x26, 0x26, 0x26, 0x26, 0x26, 0x25, 0x25, 0x25, 0x25, 0x25, 0x25, 0x25, 0x25, 0x25, 0x25, 0x25, 0x25, 0x25, 0x25, 0x25, 0x25, 0x25, 0x25, 0x25, 0x25, 0x25, 0x25, 0x25, 0x25, 0x25, 0x25,
-  0x25, 0x25, 0x25, 0x25, 0x25, 0x25, 0x25, 0x25, 0x25, 0x25, 0x25, 0x25, 0x25, 0x25, 0x25, 0x25, 0x25, 0x24, 0x24, 0x24, 0x24, 0x24, 0x24, 0x24, 0x24, 0x24, 0x24, 0x24, 0x24, 0x24, 0x24, 0x24, 0x24, 0x24, 0x24, 0x24, 0x24, 0x24, 0x24, 0x24, 0x24, 0x24, 0x24, 0x24, 0x24, 0x24, 0x24, 0x24, 0x24, 0x24, 0x24, 0x24, 0x24, 0x24, 0x24, 0x24, 0x24, 0x24, 0x24, 0x24, 0x24, 0x24, 0x24, 0x24, 0x23, 0x23, 0x23, 0x23, 0x23, 0x23, 0x23, 0x23, 0x23, 0x23, 0x23, 0x23, 0x23, 0x23, 0x23, 0x23, 0x23, 0x23, 0x23, 0x23, 0x23, 0x23, 0x23, 0x23, 0x23, 0x23, 0x23, 0x23, 0x23, 0x23, 0x23, 0x23, 0x23, 0x23, 0x23, 0x23, 0x23, 0x23, 0x23, 0x23, 0x23, 0x23, 0x23, 0x23, 0x23, 0x23, 0x23, 0x23, 0x23, 0x23, 0x23, 0x23, 0x23, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x22, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21, 0x21, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x20, 0x1f, 0x1f, 0x1f, 0x1f, 0x1f, 0x1f, 0x1f, 0x1f, 0x1f, 0x1f, 0x1f, 0x1f, 0x1f, 0x1f, 0x1f, 0x1f, 0x1f, 0x1f, 0x1f, 0x1f, 0x1f, 0x1f, 0x1f, 0x1f, 0x1f, 0x1f, 0x1f, 0x1f, 0x1f, 0x1f, 0x1f, 0x1f, 0x1f, 0x1f, 0x1f, 0x1f, 0x1f, 0x1f, 0x1f, 0x1f, 0x1f, 0x1f, 0x1f, 0x1f, 0x1f, 0x1f, 0x1f, 0x1f, 0x1f, 0x1f, 0x1f, 0x1f, 0x1f, 0x1f, 0x1f, 0x1f, 0x1f, 0x1f, 0x1f, 0x1f, 0x1f, 0x1f, 0x1f, 0x1f, 0x1f, 0x1f, 0x1f, 0x1f, 0x1f, 0x1f, 0x1f, 0x1f, 0x1f, 0x1f, 0x1f, 0x1f, 0x1f, 0x1f, 0x1f, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1e, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1d, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1c, 0x1b, 0x1b, 0x1b, 0x1b, 0x1b, 0x1b, 0x1b, 0x1b, 0x1b, 0x1b, 0x1b, 0x1b, 0x1b, 0x1b, 0x1b, 0x1b, 0x1b, 0x1b, 0x1b, 0x1b, 0x1b, 0x1b, 0x1b, 0x1b, 0x1b, 0x1b, 0x1b, 0x1b, 0x1b, 0x1b, 0x1b, 0x1b, 0x1b, 0x1b, 0x1b, 0x1b, 0x1b, 0x1b, 0x1b, 0x1b, 0x1b, 0x1b, 0x1b, 0x1b, 0x1b, 0x1b, 0x1b, 0x1b, 0x1b, 0x1b, 0x1b, 0x1b, 0x1b, 0x1b, 0x1b, 0x1b, 0x1b, 0x1b, 0x1b, 0x1b, 0x1b, 0x1b, 0x1b, 0x1b, 0x1b, 0x1b, 0x1b, 0x1b, 0x1b, 0x1b, 0x1b, 0x1b, 0x1b, 0x1b, 0x1b, 0x1b, 0x1b, 0x1b, 0x1b, 0x1b, 0x1b, 0x1b, 0x1b, 0x1b, 0x1b, 0x1b, 0x1b, 0x1b, 0x1b, 0x1b, 0x1b, 0x1b, 0x1b, 0x1b, 0x1b, 0x1b, 0x1b, 0x1b, 0x1b, 0x1b, 0x1b, 0x1b, 0x1b, 0x1b, 0x1b, 0x1b, 0x1b, 0x1b, 0x1b, 0x1b, 0x1b, 0x1b, 0x1b, 0x1b, 0x1b, 0x1b, 0x1b, 0x1b, 0x1b, 0x1b, 0x1b, 0x1b, 0x1b, 0x1b, 0x1b, 0x1b, 0x1b, 0x1b, 0x1a, 0x1a, 0x1a, 0x1a, 0x1a, 0x1a, 0x1a, 0x1a, 0x1a, 0x1a, 0x1a, 0x1a, 0x1a, 0x1a, 0x1a, 0x1a, 0x1a, 0x1a, 0x1a, 0x1a, 0x1a, 0x1a, 0x1a, 0x1a, 0x1a, 0x1a, 0x1a, 0x1a, 0x1a, 0x1a, 0x1a, 0x1a, 0x1a, 0x1a, 0x1a, 0x1a, 0x1a, 0x1a, 0x1a, 0x1a, 0x1a, 0x1a, 0x1a, 0x1a, 0x1a, 0x1a, 0x1a, 0x1a, 0x1a, 0x1a, 0x1a, 0x1a, 0x1a, 0x1a, 0x1a, 0x1a, 0x1a, 0x1a, 0x1a, 0x1a, 0x1a, 0x1a, 0x1a, 0x1a, 0x1a, 0x1a, 0x1a, 0x1a, 0x1a, 0x1a, 0x1a, 0x1a, 0x1a, 0x1a, 0x1a, 0x1a, 0x1a, 0x1a, 0x1a, 0x1a, 0x1a, 0x1a, 0x1a, 0x1a, 0x1a, 0x1a, 0x1a, 0x1a, 0x1a, 0x1a, 0x1a, 0x1a, 0x1a, 0x1a, 0x1a, 0x1a, 0x1a, 0x1a, 0x1a, 0x1a, 0x1a, 0x1a, 0x1a, 0x1a, 0x1a, 0x1a, 0x1a, 0x1a, 0x1a, 0x1a, 0x1a, 0x1a, 0x1a, 0x1a, 0x1a, 0x1a, 0x1a, 0x1a, 0x1a, 0x1a, 0x1a, 0x1a, 0x1a, 0x1a, 0x1a, 0x1a, 0x1a, 0x1a, 0x1a, 0x1a, 0x1a, 0x1a, 0x1a, 0x1a, 0x1a, 0x1a, 0x1a, 0x1a, 0x1a, 0x1a, 0x1a, 0x1a, 0x1a, 0x1a, 0x1a, 0x1a, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x19, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x18, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x16, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x15, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x14, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x13, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12, 0x12};
+typedef enum {
+  BENCH_LIVE,
+  BENCH_IDLE,
+  BENCH_BURST,
+  BENCH_VELOCITY
+} bench_source_t;
 
-inline void uart_init()
+typedef struct {
+  uint8_t  kernel;
+  uint8_t  source;
+  uint16_t passes;
+  uint32_t cycles;
+  uint16_t events;
+} bench_result_t;
+
+// Synthetic contact pattern for all lines of every channel (inputs are
+// active low): first contact, both contacts (note-on), second contact
+// released, both released (note-off). A steady 0xffff is the idle pattern.
+const uint16_t bench_burst[][2] PROGMEM = {
+  { 0xffff, 0x0000 },
+  { 0x0000, 0x0000 },
+  { 0xffff, 0x0000 },
+  { 0xffff, 0xffff }
+};
+
+void bench_scan(uint8_t kernel, bench_source_t source, uint16_t passes)
 {
-  uint16_t baud = (((F_CPU) + 8UL * (MIDI_BAUD_RATE)) / (16UL * (MIDI_BAUD_RATE)) - 1UL);
+  bench_result_t result = { kernel, (uint8_t)source, passes, 0, 0 };
+  scan_kernel_t scan = (scan_kernel_t)pgm_read_word(&scan_kernels[kernel]);
+  uint16_t inputA = 0xffff, inputB = 0xffff;
+  uint16_t timestampA, timestampB;
 
-  UBRRH = baud >> 8;
-  UBRRL = baud;
-  UCSRB = _BV(RXEN) | _BV(TXEN);
+  scan_init();
+  output_events = 0;
+
+  for(uint16_t pass = 0; pass < passes; ++pass) {
+    if(source == BENCH_BURST) {
+      inputA = pgm_read_word(&bench_burst[pass & 0b11][0]);
+      inputB = pgm_read_word(&bench_burst[pass & 0b11][1]);
+    }
+
+    // timed per channel, a whole pass of high resolution events can take
+    // more cycles than timer1 counts
+    for(uint8_t chan = 0; chan < CHANNELS; chan++) {
+      cli();
+      uint16_t start = TCNT1;
+      if(source == BENCH_LIVE) {
+        read_channel(chan, &inputA, &inputB, &timestampA, &timestampB);
+      } else {
+        timestampA = timestampB = TCNT1;
+      }
+      scan(chan, inputA, inputB, timestampA, timestampB);
+      scan_drain(0xff);
+      result.cycles += (uint16_t)(TCNT1 - start);
+      sei();
+    }
+  }
+
+  result.events = output_events;
+  reply_data(REPLY_BENCHMARK, &result, sizeof(result));
+}
+
+void bench_velocity(uint8_t kernel, uint16_t lookups)
+{
+  bench_result_t result = { kernel, BENCH_VELOCITY, lookups, 0, lookups };
+  volatile uint8_t sink;
+
+  velocity_kernel_t lookup = (velocity_kernel_t)pgm_read_word(&velocity_kernels[kernel]);
+
+  for(uint16_t i = 0; i < lookups; i += 0x100) {
+    uint16_t n = min(lookups - i, 0x100);
+
+    cli();
+    uint16_t start = TCNT1;
+    for(uint16_t j = 0; j < n; ++j) {
+      sink = lookup((i + j) << 2);
+    }
+    result.cycles += (uint16_t)(TCNT1 - start);
+    sei();
+  }
+
+  reply_data(REPLY_BENCHMARK, &result, sizeof(result));
+}
+
+// Standard workload for the output profiles, played BENCH_ROUNDS times:
+// a pedalled phrase with chords, overlapping legato notes and a program
+// change, as { event, data1, data2 }.
+#define BENCH_ROUNDS 8
+
+const uint8_t bench_workload[][3] PROGMEM = {
+  { EVENT_PROGRAM,  0x00,               0x00 },
+  { EVENT_CONTROL,  MIDI_SUSTAIN_PEDAL, 0x40 },
+  { EVENT_NOTE_ON,  0x30,               0x50 },
+  { EVENT_NOTE_ON,  0x34,               0x48 },
+  { EVENT_NOTE_ON,  0x37,               0x4c },
+  { EVENT_NOTE_ON,  0x3c,               0x60 },
+  { EVENT_NOTE_OFF, 0x30,               0x00 },
+  { EVENT_NOTE_OFF, 0x34,               0x00 },
+  { EVENT_NOTE_OFF, 0x37,               0x00 },
+  { EVENT_NOTE_ON,  0x3e,               0x58 },
+  { EVENT_NOTE_OFF, 0x3c,               0x00 },
+  { EVENT_NOTE_ON,  0x40,               0x5c },
+  { EVENT_NOTE_OFF, 0x3e,               0x00 },
+  { EVENT_CONTROL,  MIDI_SUSTAIN_PEDAL, 0x00 },
+  { EVENT_NOTE_ON,  0x41,               0x3a },
+  { EVENT_NOTE_OFF, 0x40,               0x00 },
+  { EVENT_NOTE_OFF, 0x41,               0x00 }
+};
+
+// Sends the workload through each output profile on PORT_COUNTER, one
+// REPLY_ENCODING per profile with the events, bytes and cycles it took.
+void bench_encoding()
+{
+  const uint8_t events = sizeof(bench_workload) / sizeof(bench_workload[0]);
+
+  for(uint8_t profile = 0; profile < OUTPUT_PROFILES; ++profile) {
+    struct {
+      uint8_t  profile;
+      uint16_t events;
+      uint16_t bytes;
+      uint32_t cycles;
+    } result = { profile, BENCH_ROUNDS * events, 0, 0 };
+
+    encoder_compile(MIDI_PORTS - 1, profile);
+    midi_counted = 0;
+
+    for(uint8_t round = 0; round < BENCH_ROUNDS; ++round) {
+      cli();
+      uint16_t start = TCNT1;
+      for(uint8_t i = 0; i < events; ++i) {
+        midi_event(PORT_COUNTER, pgm_read_byte(&bench_workload[i][0]),
+          pgm_read_byte(&bench_workload[i][1]), pgm_read_byte(&bench_workload[i][2]), i);
+      }
+      result.cycles += (uint16_t)(TCNT1 - start);
+      sei();
+    }
+
+    result.bytes = midi_counted;
+    reply_data(REPLY_ENCODING, &result, sizeof(result));
+  }
 }
 
-inline void uart_putc(uint8_t byte)
+// Runs every kernel for the given number of passes with timer1 counting CPU
+// cycles, one REPLY_BENCHMARK per kernel and source. Pending key events are
+// sent first and note output is muted, the key states and timer1 are put
+// back afterwards, so the keyboard carries on as before; only keys held
+// during the run may get a wrong velocity. Pedal edges stay pending in INTF1
+// until the end. The scan passes include encoding every event they detect,
+// on PORT_COUNTER with the profile of the primary port, but not its
+// transmission. Last come the output profiles, see bench_encoding.
+inline void benchmark(uint16_t passes)
 {
-  while(!(UCSRA & _BV(UDRE)));
-  UDR = byte;
+  uint16_t savedA[CHANNELS], savedB[CHANNELS];
+  uint16_t now = TCNT1;
+
+  for(uint8_t chan = 0; chan < CHANNELS; chan++) {
+    scan_flush(chan);
+    savedA[chan] = stateA[chan];
+    savedB[chan] = stateB[chan];
+  }
+
+  // the timed sections hold off interrupts, which would stretch a bit of
+  // the soft UART; the replies of the run only go to the hardware UART
+  while(!soft_uart_idle || uart_tx_head != uart_tx_tail);
+
+  GICR &= ~_BV(INT1);
+  encoder_compile(MIDI_PORTS - 1, encoders[0].profile);
+  output_muted = true;
+  TCCR1B = (1 << CS10);
+
+  for(uint8_t kernel = 0; kernel < sizeof(scan_kernels) / sizeof(scan_kernels[0]); ++kernel) {
+    bench_scan(kernel, BENCH_LIVE, passes);
+    bench_scan(kernel, BENCH_IDLE, passes);
+    bench_scan(kernel, BENCH_BURST, passes);
+  }
+  for(uint8_t kernel = 0; kernel < sizeof(velocity_kernels) / sizeof(velocity_kernels[0]); ++kernel) {
+    bench_velocity(kernel, passes);
+  }
+  bench_encoding();
+
+  TCCR1B = (1 << CS12) | (1 << CS10);
+  TCNT1 = now;
+  output_muted = false;
+  GICR |= _BV(INT1);
+
+  for(uint8_t chan = 0; chan < CHANNELS; chan++) {
+    stateA[chan] = savedA[chan];
+    stateB[chan] = savedB[chan];
+  }
 }
 
-inline void midi_note_on(uint8_t note, uint8_t velocity)
+//// TEST ////
+
+// Factory test: a technician sweeps the keybed once, pressing and releasing
+// every key, and the host fetches a single report. The test is started by
+// SysEx or by holding the soft pedal alone while the board powers up, which
+// cannot happen while playing. Holding both pedals at power-up starts the
+// bootloader instead (bootloader_active), and with no pedals plugged in both
+// pins read high, so neither gesture fires by accident. Note output is muted
+// meanwhile, pedals still send.
+// Per key the touch duration (B to A contact) of the first stroke and the
+// bounces are recorded in place of the velocity table, which test_stop
+// expands again, followed by the same for the alias lines (KEY_ALIAS). A bounce is a key in flight that changes state
+// without completing its note, e.g. the B contact opening again before A
+// closed.
+bool     testing;
+
+inline void test_start()
 {
-  uart_putc(MIDI_NOTE_ON);
-  uart_putc(note);
-  uart_putc(velocity);
+  for(uint8_t chan = 0; chan < CHANNELS; chan++) {
+    scan_flush(chan);
+  }
+
+  memset(test_record.duration, 0xff, sizeof(test_record.duration));
+  memset(test_record.bounce, 0, sizeof(test_record.bounce));
+  output_muted = true;
+  testing = true;
 }
 
-inline void midi_note_off(uint8_t note)
+inline void test_stop()
 {
-  midi_note_on(note, 0x00);
+  // what was queued during the test stays muted
+  for(uint8_t chan = 0; chan < CHANNELS; chan++) {
+    scan_flush(chan);
+  }
+
+  testing = false;
+  output_muted = false;
+  curve_expand();
 }
 
-inline void midi_program(uint8_t program)
+typedef enum {
+  TEST_PASSED,
+  TEST_OUTLIER,
+  TEST_FAILED
+} test_result_t;
+
+inline uint8_t test_bounce(uint8_t key)
+{
+  return (test_record.bounce[key >> 1] >> ((key & 1) << 2)) & 0x0f;
+}
+
+// A key passes if it was struck, did not bounce and is back at rest, and is
+// an outlier if it passed more than twice as fast or slow as the median.
+inline test_result_t test_result(uint8_t key, bool rest, uint16_t median)
+{
+  uint16_t duration = test_record.duration[key];
+
+  if(duration == 0xffff || test_bounce(key) || !rest) {
+    return TEST_FAILED;
+  }
+  if(duration > (uint32_t)median * 2 || duration < median / 2) {
+    return TEST_OUTLIER;
+  }
+  return TEST_PASSED;
+}
+
+PROFILED inline void test_channel(uint8_t chan, uint16_t inputA, uint16_t inputB,
+  uint16_t timestampA, uint16_t timestampB)
+{
+  uint16_t oldA = stateA[chan], oldB = stateB[chan];
+  uint16_t note_on = oldB & ~inputA & ~inputB;
+  uint16_t note_off = ~oldB & inputA & inputB;
+  uint16_t bounce;
+
+  scan_live(chan, inputA, inputB, timestampA, timestampB);
+
+  bounce = (oldA ^ oldB) & ((oldA ^ stateA[chan]) | (oldB ^ stateB[chan])) & ~(note_on | note_off);
+
+  // the timer of a new note-on holds its touch duration
+  for_set_bits(line, note_on) {
+    uint8_t key = TEST_SLOT(chan, line);
+    if(test_record.duration[key] == 0xffff) {
+      test_record.duration[key] = timers[KEY_INDEX(chan, line)];
+    }
+  }
+
+  for_set_bits(line, bounce) {
+    uint8_t key = TEST_SLOT(chan, line);
+    if(test_bounce(key) != 0x0f) {
+      test_record.bounce[key >> 1] += 1 << ((key & 1) << 2);
+    }
+  }
+}
+
+// Median of the recorded durations, 0xffff if no key was struck.
+inline uint16_t test_median()
+{
+  uint8_t struck = 0;
+
+  for(uint8_t key = 0; key < KEY_COUNT; ++key) {
+    struck += test_record.duration[key] != 0xffff;
+  }
+
+  for(uint8_t key = 0; key < KEY_COUNT; ++key) {
+    uint16_t duration = test_record.duration[key];
+    uint8_t below = 0, equal = 0;
+
+    if(duration == 0xffff) {
+      continue;
+    }
+    for(uint8_t other = 0; other < KEY_COUNT; ++other) {
+      below += test_record.duration[other] < duration;
+      equal += test_record.duration[other] == duration;
+    }
+    if(below <= struck / 2 && struck / 2 < below + equal) {
+      return duration;
+    }
+  }
+
+  return 0xffff;
+}
+
+// The report has a bit per key that passed, the median duration, count,
+// alias and the outliers: every failed key and every outlier, the first
+// TEST_OUTLIERS of them in scan order; count is their total. alias has a bit
+// per alias line that was struck, bounced or is not at rest. Only the header
+// is assembled, in a first pass over the lines; the outliers are sent as a
+// second pass finds them, which keeps the stack small.
+inline void test_dump()
 {
-  uart_putc(MIDI_PROGRAM);
-  uart_putc(program);
+  struct {
+    uint8_t  passed[(KEY_COUNT + 7) / 8];
+    uint16_t median;
+    uint8_t  count;
+    uint8_t  alias;
+  } report;
+  uint8_t listed = 0;
+
+  memset(&report, 0, sizeof(report));
+  report.median = test_median();
+
+  for(uint8_t chan = 0; chan < CHANNELS; chan++) {
+    for(uint8_t line = 0; line < 16; line++) {
+      uint8_t key = TEST_SLOT(chan, line);
+      bool    rest = (stateA[chan] & stateB[chan]) >> line & 1;
+
+      if(key >= KEY_COUNT) {
+        if(test_record.duration[key] != 0xffff || test_bounce(key) || !rest) {
+          report.alias |= _BV(key - KEY_COUNT);
+        }
+        continue;
+      }
+
+      test_result_t result = test_result(key, rest, report.median);
+      if(result != TEST_FAILED) {
+        report.passed[key >> 3] |= _BV(key & 0b111);
+      }
+      report.count += result != TEST_PASSED;
+    }
+  }
+
+  send_begin(REPLY_TEST);
+  send_params(&report, sizeof(report));
+
+  for(uint8_t chan = 0; chan < CHANNELS; chan++) {
+    for(uint8_t line = 0; line < 16 && listed < TEST_OUTLIERS; line++) {
+      uint8_t key = TEST_SLOT(chan, line);
+      bool    rest = (stateA[chan] & stateB[chan]) >> line & 1;
+
+      if(key >= KEY_COUNT || test_result(key, rest, report.median) == TEST_PASSED) {
+        continue;
+      }
+
+      uint16_t duration = test_record.duration[key];
+      send_byte(key);
+      send_byte(test_bounce(key));
+      send_byte(duration);
+      send_byte(duration >> 8);
+      listed++;
+    }
+  }
+
+  send_end();
+}
+
+// COMMANDS
+
+inline void reply_curve()
+{
+  struct {
+    uint8_t  params[sizeof(curve_params)];
+    uint16_t ticks;
+  } reply;
+
+  memcpy(reply.params, &curve_params, sizeof(curve_params));
+  reply.ticks = curve_ticks;
+  reply_data(REPLY_CURVE, &reply, sizeof(reply));
+}
+
+#define CHECK(EXPR, ERR) \
+  if(!(EXPR)) { \
+    reply_error(ERR); \
+    break; \
+  }
+
+inline void process_msg()
+{
+  switch(msg.command) {
+    case COMMAND_SET_ROUTING:
+      CHECK(payload_size == sizeof(route), ERROR_INVALID_PAYLOAD_SIZE)
+      CHECK(msg.params[0] <= KEY_COUNT && msg.params[1] <= PORT_BOTH &&
+        msg.params[2] <= PORT_BOTH && msg.params[3] <= PORT_BOTH,
+        ERROR_INVALID_PARAMETER)
+      route.split = msg.params[0];
+      route.low = msg.params[1];
+      route.high = msg.params[2];
+      route.control = msg.params[3];
+      reply_success();
+      break;
+
+    // ports, profile, store: selects the output profile of each port in
+    // the mask, and keeps it across resets if store is set
+    case COMMAND_SET_OUTPUT:
+      CHECK(payload_size == 3, ERROR_INVALID_PAYLOAD_SIZE)
+      CHECK(msg.params[0] <= PORT_BOTH && msg.params[1] < OUTPUT_PROFILES &&
+        msg.params[2] <= 1, ERROR_INVALID_PARAMETER)
+      for(uint8_t port = 0; port < MIDI_PORTS - 1; ++port) {
+        if(msg.params[0] & _BV(port)) {
+          encoder_compile(port, msg.params[1]);
+          if(msg.params[2]) {
+            eeprom_update_byte(&stored_profiles[port], msg.params[1]);
+          }
+        }
+      }
+      reply_success();
+      break;
+
+    // step, microseconds, store: sets the settle time of one step, and
+    // keeps it across resets if store is set
+    case COMMAND_SET_SETTLE: {
+      CHECK(payload_size == 3, ERROR_INVALID_PAYLOAD_SIZE)
+      CHECK(msg.params[0] < SCAN_STEPS && msg.params[1] &&
+        msg.params[1] <= SETTLE_MAX_US && msg.params[2] <= 1, ERROR_INVALID_PARAMETER)
+#ifdef PASS_TIMING
+      // the passes of the fixed schedule must still fit
+      uint16_t total = SETTLE_COUNT(msg.params[1]);
+      for(uint8_t step = 0; step < SCAN_STEPS; ++step) {
+        total += step == msg.params[0] ? 0 : channel_settle[step];
+      }
+      CHECK(total <= SETTLE_COUNT(PASS_SETTLE_US), ERROR_INVALID_PARAMETER)
+#endif
+      channel_settle[msg.params[0]] = SETTLE_COUNT(msg.params[1]);
+      if(msg.params[2]) {
+        eeprom_update_byte(&stored_settle[msg.params[0]], msg.params[1]);
+      }
+      reply_success();
+      break;
+    }
+
+    case COMMAND_BENCHMARK: {
+      CHECK(payload_size == 2, ERROR_INVALID_PAYLOAD_SIZE)
+      CHECK(!testing, ERROR_TEST_ACTIVE)
+      uint16_t passes = msg.params[0] | (msg.params[1] << 8);
+      CHECK(passes, ERROR_INVALID_PARAMETER)
+      benchmark(passes);
+      reply_success();
+      break;
+    }
+
+    case COMMAND_SET_CURVE: {
+      CHECK(payload_size == sizeof(curve_params), ERROR_INVALID_PAYLOAD_SIZE)
+      CHECK(!testing, ERROR_TEST_ACTIVE)
+      uint16_t range = msg.params[4] | (msg.params[5] << 8);
+      CHECK(msg.params[0] && msg.params[1] && msg.params[1] <= msg.params[2] &&
+        msg.params[2] <= 127 && msg.params[3] && range > msg.params[3],
+        ERROR_INVALID_PARAMETER)
+      memcpy(&curve_params, msg.params, sizeof(curve_params));
+      curve_expand();
+      reply_curve();
+      break;
+    }
+
+    case COMMAND_TEST_START:
+      CHECK(!payload_size, ERROR_INVALID_PAYLOAD_SIZE)
+      if(!testing) {
+        test_start();
+      }
+      reply_success();
+      break;
+
+    case COMMAND_TEST_DUMP:
+      CHECK(!payload_size, ERROR_INVALID_PAYLOAD_SIZE)
+      CHECK(testing, ERROR_INVALID_PARAMETER)
+      test_dump();
+      break;
+
+    case COMMAND_TEST_STOP:
+      CHECK(!payload_size, ERROR_INVALID_PAYLOAD_SIZE)
+      if(testing) {
+        test_stop();
+      }
+      reply_success();
+      break;
+
+    case COMMAND_GET_CURVE:
+      CHECK(!payload_size, ERROR_INVALID_PAYLOAD_SIZE)
+      reply_curve();
+      break;
+
+#ifdef PROFILER
+    case COMMAND_PROFILE_START:
+      CHECK(payload_size == 3, ERROR_INVALID_PAYLOAD_SIZE)
+      CHECK(msg.params[2] < 14, ERROR_INVALID_PARAMETER)
+      profile_start(msg.params[0] | (msg.params[1] << 8), msg.params[2]);
+      reply_success();
+      break;
+
+    case COMMAND_PROFILE_STOP:
+      CHECK(!payload_size, ERROR_INVALID_PAYLOAD_SIZE)
+      profile_stop();
+      reply_success();
+      break;
+
+    case COMMAND_PROFILE_DUMP: {
+      CHECK(!payload_size, ERROR_INVALID_PAYLOAD_SIZE)
+      // hold the sampler so the counters don't tear while they are sent
+      uint8_t timsk = TIMSK;
+      profile_stop();
+      reply_data(REPLY_PROFILE, &profile, sizeof(profile));
+      TIMSK = timsk;
+      break;
+    }
+#endif
+
+    default:
+      reply_error(ERROR_UNKNOWN_COMMAND);
+      break;
+  }
+}
+
+PROFILED inline void sysex_poll()
+{
+  if(msg_status == MSG_EMPTY) {
+    return;
+  }
+
+  if(msg_status == ERROR_NONE) {
+    process_msg();
+  } else {
+    reply_error(msg_status);
+  }
+
+  msg_status = MSG_EMPTY;
 }
 
 int main()
 {
-  uint16_t stateA[6], stateB[6];
   uint16_t inputA, inputB;
-  uint16_t timer, note_on, note_off;
-  uint16_t timestamp;
-  uint16_t timers[96];
-
-  uint8_t stateP;
-  uint8_t inputP;
-  uint8_t pedals;
+  uint16_t timestampA, timestampB;
 
   // set PORTA and PORTC as input with pullup
   DDRA  = 0x00;
@@ -144,54 +1952,66 @@ int main()
   DDRB = 0x0f;
 
   DDRD  = _BV(PD5);
-  PORTD = _BV(PD3) | _BV(PD4);
+  PORTD = _BV(PD3) | _BV(PD4) | _BV(PD5);
 
   // set timer1 pre-scaler to 1024
   TCCR1B = (1 << CS12) | (1 << CS10);
 
+  settle_init();
+  scan_init();
+  curve_expand();
+
   uart_init();
+  soft_uart_init();
+  midi_init();
+  sysex_init();
+  pedals_init();
 
-  for(;;) {
+  // both pedals held is the bootloader's gesture and never gets here
+  if(!pedals[0].pressed && pedals[1].pressed) {
+    test_start();
+  }
 
-    for(uint8_t chan = 0; chan < 6; chan++) {
+  sei();
 
-      READ_LINES(chan << 1, inputA);
-      READ_LINES((chan << 1) + 1, inputB);
+#ifdef PASS_TIMING
+  uint16_t pass_start = TCNT1;
+#endif
 
-      // time measurements
-      timer = (stateA[chan] ^ ~stateB[chan]) & (inputA ^ inputB | stateA[chan] ^ inputA);
-      timestamp = TCNT1;
+  for(;;) {
+    uint8_t budget = OUTPUT_BUDGET;
 
-      for_set_bits(line, timer) {
-        timers[KEY_INDEX(chan, line)] = timestamp;
-      }
+#ifdef PASS_TIMING
+    // passes start every PASS_TICKS; the passes after an overrun run back
+    // to back until the schedule has caught up, so the counts still match
+    // the time that went by. Only after a long stall, such as a SysEx
+    // command, the schedule starts over.
+    while((uint16_t)(TCNT1 - pass_start) < PASS_TICKS);
+    pass_start += PASS_TICKS;
+    if((uint16_t)(TCNT1 - pass_start) >= PASS_CATCH_UP * PASS_TICKS) {
+      pass_start = TCNT1;
+    }
+#endif
 
-      // output notes
-      note_on = stateB[chan] & ~inputA & ~inputB;
-      note_off = ~stateB[chan] & inputA & inputB;
+    for(uint8_t chan = 0; chan < CHANNELS; chan++) {
 
-      for_set_bits(line, note_on) {
-        uint16_t touch_duration = timestamp - timers[KEY_INDEX(chan, line)];
-        touch_duration = min(touch_duration, sizeof(velocities) - 1);
-        uint8_t velocity = pgm_read_byte(&(velocities[touch_duration]));
-        midi_note_on(MIDI_KEY(chan, line), 100);
-      }
+      read_channel(chan, &inputA, &inputB, &timestampA, &timestampB);
 
-      for_set_bits(line, note_off) {
-        midi_note_off(MIDI_KEY(chan, line));
+      if(testing) {
+        test_channel(chan, inputA, inputB, timestampA, timestampB);
+      } else {
+        scan_live(chan, inputA, inputB, timestampA, timestampB);
       }
+      budget = scan_drain(budget);
 
-      // update states
-      stateA[chan] = inputB | (~stateB[chan] & inputA);
-      stateB[chan] = stateA[chan] ^ inputA ^ inputB;
+      // pedal edges are queued by interrupt, send them between channels
+      pedals_flush();
     }
 
-    inputP = PIND;
-    pedals = inputP ^ stateP;
-
-    HANDLE_PEDAL(SUSTAIN_PEDAL, MIDI_SUSTAIN_PEDAL)
-    HANDLE_PEDAL(SOFT_PEDAL, MIDI_SOFT_PEDAL)
+    pedals_update();
+    pedals_flush();
+    output_pass_done(budget);
 
-    stateP = inputP;
+    sysex_poll();
   }
 }
@@ -0,0 +1,151 @@
+use reply::{read_u16, read_u32, Reply, REPLY_BENCHMARK, REPLY_ENCODING};
+
+#[derive(Debug, PartialEq)]
+pub enum Source {
+    Live,
+    Idle,
+    Burst,
+    Velocity,
+}
+
+// One line of the firmware's self-benchmark: a kernel run for a number of
+// passes (or lookups) with timer1 counting CPU cycles.
+#[derive(Debug)]
+pub struct BenchResult {
+    pub kernel: u8,
+    pub source: Source,
+    pub passes: u16,
+    pub cycles: u32,
+    pub events: u16,
+}
+
+impl BenchResult {
+    pub fn from_reply(reply: &Reply) -> Option<BenchResult> {
+        let params = &reply.params;
+        if reply.command != REPLY_BENCHMARK || params.len() != 10 {
+            return None;
+        }
+
+        let source = match params[1] {
+            0 => Source::Live,
+            1 => Source::Idle,
+            2 => Source::Burst,
+            3 => Source::Velocity,
+            _ => return None,
+        };
+
+        Some(BenchResult {
+            kernel: params[0],
+            source: source,
+            passes: read_u16(params, 2),
+            cycles: read_u32(params, 4),
+            events: read_u16(params, 8),
+        })
+    }
+
+    pub fn cycles_per_pass(&self) -> f64 {
+        self.cycles as f64 / self.passes as f64
+    }
+}
+
+// Cost of handling one event: the burst run minus the idle run of the same
+// kernel, divided by the events the burst produced.
+pub fn cycles_per_event(idle: &BenchResult, burst: &BenchResult) -> Option<f64> {
+    if burst.events == 0 {
+        return None;
+    }
+    Some((burst.cycles as f64 - idle.cycles as f64) / burst.events as f64)
+}
+
+// The firmware's standard workload sent through one output profile.
+#[derive(Debug)]
+pub struct EncodingResult {
+    pub profile: u8,
+    pub events: u16,
+    pub bytes: u16,
+    pub cycles: u32,
+}
+
+impl EncodingResult {
+    pub fn from_reply(reply: &Reply) -> Option<EncodingResult> {
+        let params = &reply.params;
+        if reply.command != REPLY_ENCODING || params.len() != 9 {
+            return None;
+        }
+
+        Some(EncodingResult {
+            profile: params[0],
+            events: read_u16(params, 1),
+            bytes: read_u16(params, 3),
+            cycles: read_u32(params, 5),
+        })
+    }
+
+    pub fn bytes_per_event(&self) -> f64 {
+        self.bytes as f64 / self.events as f64
+    }
+
+    pub fn cycles_per_event(&self) -> f64 {
+        self.cycles as f64 / self.events as f64
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use reply::{to_sysex, REPLY_SUCCESS};
+
+    fn reply(command: u8, params: &[u8]) -> Reply {
+        Reply::from_sysex(&to_sysex(command, params)).unwrap()
+    }
+
+    // bench_result_t of kernel 0: 1000 passes, 0x000f4240 cycles, 0 events
+    const IDLE: [u8; 10] = [0x00, 0x01, 0xe8, 0x03, 0x40, 0x42, 0x0f, 0x00, 0x00, 0x00];
+
+    // the same kernel on the burst pattern: 0x00124f80 cycles, 88 events
+    const BURST: [u8; 10] = [0x00, 0x02, 0xe8, 0x03, 0x80, 0x4f, 0x12, 0x00, 0x58, 0x00];
+
+    #[test]
+    fn decodes_results() {
+        let idle = BenchResult::from_reply(&reply(REPLY_BENCHMARK, &IDLE)).unwrap();
+        assert_eq!(idle.kernel, 0);
+        assert_eq!(idle.source, Source::Idle);
+        assert_eq!(idle.passes, 1000);
+        assert_eq!(idle.cycles, 1000000);
+        assert_eq!(idle.events, 0);
+        assert_eq!(idle.cycles_per_pass(), 1000.0);
+
+        let burst = BenchResult::from_reply(&reply(REPLY_BENCHMARK, &BURST)).unwrap();
+        assert_eq!(burst.source, Source::Burst);
+        assert_eq!(burst.cycles, 1200000);
+        assert_eq!(burst.events, 88);
+        assert_eq!(cycles_per_event(&idle, &burst), Some(200000.0 / 88.0));
+        assert_eq!(cycles_per_event(&burst, &idle), None);
+    }
+
+    #[test]
+    fn decodes_encodings() {
+        // the compact profile: 136 events in 0x0148 bytes and 0x00011170 cycles
+        let params = [0x01, 0x88, 0x00, 0x48, 0x01, 0x70, 0x11, 0x01, 0x00];
+        let result = EncodingResult::from_reply(&reply(REPLY_ENCODING, &params)).unwrap();
+        assert_eq!(result.profile, 1);
+        assert_eq!(result.events, 136);
+        assert_eq!(result.bytes, 328);
+        assert_eq!(result.cycles, 70000);
+        assert_eq!(result.bytes_per_event(), 328.0 / 136.0);
+        assert_eq!(result.cycles_per_event(), 70000.0 / 136.0);
+
+        assert!(EncodingResult::from_reply(&reply(REPLY_BENCHMARK, &params)).is_none());
+        assert!(EncodingResult::from_reply(&reply(REPLY_ENCODING, &params[..8])).is_none());
+    }
+
+    #[test]
+    fn rejects_other_replies() {
+        assert!(BenchResult::from_reply(&reply(REPLY_SUCCESS, &[])).is_none());
+        assert!(BenchResult::from_reply(&reply(REPLY_BENCHMARK, &IDLE[..9])).is_none());
+
+        let mut source = IDLE;
+        source[1] = 4;
+        assert!(BenchResult::from_reply(&reply(REPLY_BENCHMARK, &source)).is_none());
+    }
+}
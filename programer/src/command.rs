@@ -1,6 +1,6 @@
-const VERSION: u8 = 0x01;
-const HEADER: [u8; 4] = [0xf0, 0x00, 0x70, VERSION];
-const FOOTER: [u8; 1] = [0xf7];
+pub const VERSION: u8 = 0x01;
+pub const HEADER: [u8; 4] = [0xf0, 0x00, 0x70, VERSION];
+pub const FOOTER: [u8; 1] = [0xf7];
 
 pub trait Command {
     fn to_sysex(&self) -> Vec<u8> {
@@ -31,9 +31,11 @@ impl Command for Ping {
     }
 }
 
+// The bootloader reads the page back after writing it and only replies with
+// success on an exact match, so no separate Verify pass is needed.
 pub struct Write {
-    page_no: u8,
-    page_data: Vec<u8>,
+    pub page_no: u8,
+    pub page_data: Vec<u8>,
 }
 
 impl Command for Write {
@@ -71,3 +73,205 @@ impl Command for Quit {
         vec![0x14]
     }
 }
+
+pub struct ProfileStart {
+    pub base: u16,
+    pub shift: u8,
+}
+
+impl Command for ProfileStart {
+    fn payload(&self) -> Vec<u8> {
+        vec![0x30, self.base as u8, (self.base >> 8) as u8, self.shift]
+    }
+}
+
+pub struct ProfileStop {}
+
+impl Command for ProfileStop {
+    fn payload(&self) -> Vec<u8> {
+        vec![0x31]
+    }
+}
+
+pub struct ProfileDump {}
+
+impl Command for ProfileDump {
+    fn payload(&self) -> Vec<u8> {
+        vec![0x32]
+    }
+}
+
+// Masks for the routing fields: the hardware UART and the software UART on PD5.
+pub const PORT_PRIMARY: u8 = 0x01;
+pub const PORT_SECONDARY: u8 = 0x02;
+
+pub struct SetRouting {
+    pub split: u8,
+    pub low: u8,
+    pub high: u8,
+    pub control: u8,
+}
+
+impl Command for SetRouting {
+    fn payload(&self) -> Vec<u8> {
+        vec![0x33, self.split, self.low, self.high, self.control]
+    }
+}
+
+pub struct Benchmark {
+    pub passes: u16,
+}
+
+impl Command for Benchmark {
+    fn payload(&self) -> Vec<u8> {
+        vec![0x34, self.passes as u8, (self.passes >> 8) as u8]
+    }
+}
+
+// Velocity curve parameters, see curve_params in the firmware. gamma is in
+// 1/16, knee and range are in timer1 ticks (64 us).
+pub struct SetCurve {
+    pub gamma: u8,
+    pub min: u8,
+    pub max: u8,
+    pub knee: u8,
+    pub range: u16,
+}
+
+impl Command for SetCurve {
+    fn payload(&self) -> Vec<u8> {
+        vec![
+            0x35,
+            self.gamma,
+            self.min,
+            self.max,
+            self.knee,
+            self.range as u8,
+            (self.range >> 8) as u8,
+        ]
+    }
+}
+
+pub struct GetCurve {}
+
+impl Command for GetCurve {
+    fn payload(&self) -> Vec<u8> {
+        vec![0x36]
+    }
+}
+
+// Output profiles, in firmware order.
+pub const OUTPUT_GENERIC: u8 = 0;
+pub const OUTPUT_COMPACT: u8 = 1;
+pub const OUTPUT_NOTE_OFF: u8 = 2;
+pub const OUTPUT_HIGH_RES: u8 = 3;
+
+pub const OUTPUT_NAMES: [&'static str; 4] = ["generic", "compact", "note-off", "high-res"];
+
+pub fn output_profile(name: &str) -> Option<u8> {
+    OUTPUT_NAMES
+        .iter()
+        .position(|profile| *profile == name)
+        .map(|profile| profile as u8)
+}
+
+// Selects the output profile of the ports in the mask, kept in EEPROM if
+// store is set.
+pub struct SetOutput {
+    pub ports: u8,
+    pub profile: u8,
+    pub store: bool,
+}
+
+impl Command for SetOutput {
+    fn payload(&self) -> Vec<u8> {
+        vec![0x37, self.ports, self.profile, self.store as u8]
+    }
+}
+
+// Settle time of one mux step (0-11, in scan order) in microseconds, 1-47,
+// kept across resets if store is set. Firmware built with PASS_TIMING
+// refuses settle times that add up to more than 400 us per pass.
+pub struct SetSettle {
+    pub step: u8,
+    pub micros: u8,
+    pub store: bool,
+}
+
+impl Command for SetSettle {
+    fn payload(&self) -> Vec<u8> {
+        vec![0x38, self.step, self.micros, self.store as u8]
+    }
+}
+
+// Factory test: start, fetch the report (REPLY_TEST) and leave again. The
+// test can also be started by holding the soft pedal alone while the board
+// powers up; both pedals held starts the bootloader instead.
+pub struct TestStart {}
+
+impl Command for TestStart {
+    fn payload(&self) -> Vec<u8> {
+        vec![0x39]
+    }
+}
+
+pub struct TestDump {}
+
+impl Command for TestDump {
+    fn payload(&self) -> Vec<u8> {
+        vec![0x3a]
+    }
+}
+
+pub struct TestStop {}
+
+impl Command for TestStop {
+    fn payload(&self) -> Vec<u8> {
+        vec![0x3b]
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use reply::Reply;
+
+    #[test]
+    fn frames_ping() {
+        assert_eq!(
+            Ping {}.to_sysex(),
+            vec![0xf0, 0x00, 0x70, 0x01, 0x01, 0x00, 0x01, 0x00, 0xf7]
+        );
+    }
+
+    #[test]
+    fn frames_set_output() {
+        let command = SetOutput {
+            ports: PORT_PRIMARY | PORT_SECONDARY,
+            profile: OUTPUT_HIGH_RES,
+            store: true,
+        };
+        let sysex = command.to_sysex();
+        assert_eq!(
+            sysex,
+            vec![
+                0xf0, 0x00, 0x70, 0x01, 0x03, 0x07, 0x00, 0x03, 0x00, 0x03, 0x00, 0x01, 0x03, 0x06,
+                0xf7,
+            ]
+        );
+
+        // the board checks framing and checksum the same way
+        let decoded = Reply::from_sysex(&sysex).unwrap();
+        assert_eq!(decoded.command, 0x37);
+        assert_eq!(decoded.params, vec![0x03, 0x03, 0x01]);
+    }
+
+    #[test]
+    fn names_output_profiles() {
+        assert_eq!(output_profile("generic"), Some(OUTPUT_GENERIC));
+        assert_eq!(output_profile("compact"), Some(OUTPUT_COMPACT));
+        assert_eq!(output_profile("note-off"), Some(OUTPUT_NOTE_OFF));
+        assert_eq!(output_profile("high-res"), Some(OUTPUT_HIGH_RES));
+        assert_eq!(output_profile("running"), None);
+    }
+}
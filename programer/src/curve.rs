@@ -0,0 +1,148 @@
+use reply::{read_u16, Reply, REPLY_CURVE};
+
+// Touch duration resolution of firmware built with PASS_TIMING, in ticks.
+pub const PASS_TICKS: u16 = 8;
+
+// The active velocity curve and how long the firmware took to expand it
+// into its threshold table, in timer1 ticks of 64 us.
+#[derive(Debug)]
+pub struct Curve {
+    pub gamma: u8,
+    pub min: u8,
+    pub max: u8,
+    pub knee: u8,
+    pub range: u16,
+    pub expand_ticks: u16,
+}
+
+impl Curve {
+    pub fn from_reply(reply: &Reply) -> Option<Curve> {
+        let params = &reply.params;
+        if reply.command != REPLY_CURVE || params.len() != 8 {
+            return None;
+        }
+
+        Some(Curve {
+            gamma: params[0],
+            min: params[1],
+            max: params[2],
+            knee: params[3],
+            range: read_u16(params, 4),
+            expand_ticks: read_u16(params, 6),
+        })
+    }
+
+    pub fn expand_micros(&self) -> u32 {
+        self.expand_ticks as u32 * 64
+    }
+
+    // Last duration that still yields velocity max - k, as curve_expand
+    // computes it: clamped to range before rounding, and in single precision
+    // like avr-gcc's double.
+    fn threshold(&self, k: u8) -> u16 {
+        if k >= self.max - self.min {
+            return 0xffff;
+        }
+        let base = self.max as f32 / (self.max as f32 - k as f32 - 0.5);
+        let duration = self.knee as f32 * base.powf(self.gamma as f32 / 16.0);
+        (duration.min(self.range as f32).round() as u16).wrapping_sub(1)
+    }
+
+    // Velocity for a touch duration in ticks, like velocity_lookup.
+    pub fn velocity(&self, duration: u16) -> u8 {
+        let mut exceeded = 0;
+        for k in 0..128 {
+            if self.threshold(k) < duration {
+                exceeded += 1;
+            }
+        }
+        self.max - exceeded
+    }
+
+    // Mean velocity error over all durations up to range when durations are
+    // only known in steps of resolution ticks, as with the pass counting
+    // timing engine (resolution PASS_TICKS) compared to timestamps (1).
+    pub fn quantization_error(&self, resolution: u16) -> f64 {
+        let mut total = 0u32;
+        for duration in 0..self.range {
+            let measured = duration / resolution * resolution;
+            let exact = self.velocity(duration) as i32;
+            total += (exact - self.velocity(measured) as i32).abs() as u32;
+        }
+        total as f64 / self.range as f64
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use reply::{to_sysex, REPLY_SUCCESS};
+
+    fn reply(command: u8, params: &[u8]) -> Reply {
+        Reply::from_sysex(&to_sysex(command, params)).unwrap()
+    }
+
+    // reply_curve() with the default curve (gamma 2.5, velocities 18-127,
+    // knee 31, range 4000 ticks) expanded in 0x0123 ticks
+    const DEFAULT: [u8; 8] = [0x28, 0x12, 0x7f, 0x1f, 0xa0, 0x0f, 0x23, 0x01];
+
+    fn default() -> Curve {
+        Curve::from_reply(&reply(REPLY_CURVE, &DEFAULT)).unwrap()
+    }
+
+    #[test]
+    fn decodes_curve() {
+        let curve = default();
+        assert_eq!(
+            (curve.gamma, curve.min, curve.max, curve.knee),
+            (40, 18, 127, 31)
+        );
+        assert_eq!(curve.range, 4000);
+        assert_eq!(curve.expand_micros(), 0x0123 * 64);
+
+        assert!(Curve::from_reply(&reply(REPLY_SUCCESS, &[])).is_none());
+        assert!(Curve::from_reply(&reply(REPLY_CURVE, &DEFAULT[..6])).is_none());
+    }
+
+    #[test]
+    fn maps_durations_to_velocities() {
+        let curve = default();
+        assert_eq!(curve.velocity(0), 127);
+        // thresholds 30, 31, 32, ...: the last duration of each velocity
+        assert_eq!(curve.velocity(30), 127);
+        assert_eq!(curve.velocity(31), 126);
+        assert_eq!(curve.velocity(32), 125);
+        assert_eq!(curve.velocity(4000), 18);
+        assert_eq!(curve.velocity(0xffff), 18);
+
+        let mut last = 127;
+        for duration in 0..4000 {
+            let velocity = curve.velocity(duration);
+            assert!(velocity <= last && velocity >= 18);
+            last = velocity;
+        }
+    }
+
+    #[test]
+    fn clamps_steep_curves() {
+        // gamma 15.9 overflows a u16 long before the last velocities
+        let curve = Curve {
+            gamma: 0xfe,
+            min: 1,
+            max: 127,
+            knee: 255,
+            range: 4000,
+            expand_ticks: 0,
+        };
+        assert_eq!(curve.threshold(125), 3999);
+        assert_eq!(curve.velocity(4000), 1);
+    }
+
+    #[test]
+    fn measures_quantization() {
+        let curve = default();
+        assert_eq!(curve.quantization_error(1), 0.0);
+        assert!(curve.quantization_error(8) > 0.0);
+        assert!(curve.quantization_error(8) < curve.quantization_error(16));
+    }
+}
@@ -0,0 +1,179 @@
+use reply::{read_u16, Reply, REPLY_TEST};
+
+pub const KEY_COUNT: usize = 88;
+
+// A key the firmware listed: failed, or more than twice as fast or slow as
+// the median. duration is in timer1 ticks (64 us), 0xffff if never struck.
+#[derive(Debug)]
+pub struct Outlier {
+    pub key: u8,
+    pub bounce: u8,
+    pub duration: u16,
+}
+
+// Report of the factory test after one sweep of the keybed.
+#[derive(Debug)]
+pub struct TestReport {
+    pub passed: Vec<bool>,
+    pub median: u16,
+    pub count: u8,
+    pub alias: u8,
+    pub outliers: Vec<Outlier>,
+}
+
+// What the line accepts: how far a key may be from the median duration
+// (at least 2, the firmware lists nothing closer) and how many outliers
+// a board may have.
+pub struct Limits {
+    pub max_spread: f64,
+    pub max_outliers: u8,
+}
+
+#[derive(Debug, PartialEq)]
+pub enum Failure {
+    NotStruck,
+    TooManyOutliers(u8),
+    Alias(u8),
+    Key(u8),
+    Spread(u8, u16),
+}
+
+impl TestReport {
+    pub fn from_reply(reply: &Reply) -> Option<TestReport> {
+        let params = &reply.params;
+        let bitmap = (KEY_COUNT + 7) / 8;
+        if reply.command != REPLY_TEST || params.len() < bitmap + 4 || (params.len() - bitmap - 4) % 4 != 0 {
+            return None;
+        }
+
+        Some(TestReport {
+            passed: (0..KEY_COUNT).map(|key| params[key / 8] & (1 << (key % 8)) != 0).collect(),
+            median: read_u16(params, bitmap),
+            count: params[bitmap + 2],
+            alias: params[bitmap + 3],
+            outliers: (bitmap + 4..params.len())
+                .step_by(4)
+                .map(|offset| Outlier {
+                    key: params[offset],
+                    bounce: params[offset + 1],
+                    duration: read_u16(params, offset + 2),
+                })
+                .collect(),
+        })
+    }
+
+    pub fn check(&self, limits: &Limits) -> Vec<Failure> {
+        let mut failures = Vec::new();
+
+        if self.median == 0xffff {
+            failures.push(Failure::NotStruck);
+            return failures;
+        }
+        if self.count > limits.max_outliers {
+            failures.push(Failure::TooManyOutliers(self.count));
+        }
+        // lines 0-7 of board channel 5 that saw activity, nothing should
+        // be connected there
+        if self.alias != 0 {
+            failures.push(Failure::Alias(self.alias));
+        }
+
+        for key in 0..KEY_COUNT {
+            if !self.passed[key] {
+                failures.push(Failure::Key(key as u8));
+            }
+        }
+
+        for outlier in &self.outliers {
+            let ratio = outlier.duration.max(1) as f64 / self.median.max(1) as f64;
+            if self.passed[outlier.key as usize] && (ratio > limits.max_spread || ratio < 1.0 / limits.max_spread) {
+                failures.push(Failure::Spread(outlier.key, outlier.duration));
+            }
+        }
+
+        failures
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use reply::{to_sysex, REPLY_SUCCESS};
+
+    fn reply(command: u8, params: &[u8]) -> Reply {
+        Reply::from_sysex(&to_sysex(command, params)).unwrap()
+    }
+
+    // All keys passed except key 5, which bounced twice; key 60 is three
+    // times as slow as the median of 0x0100 ticks and alias line 0 moved.
+    fn report() -> Vec<u8> {
+        let mut params = vec![0xff; 11];
+        params[0] = 0xdf;
+        params.extend([0x00, 0x01, 0x02, 0x01].iter());
+        params.extend([0x05, 0x02, 0x00, 0x01].iter());
+        params.extend([0x3c, 0x00, 0x00, 0x03].iter());
+        params
+    }
+
+    #[test]
+    fn decodes_report() {
+        let report = TestReport::from_reply(&reply(REPLY_TEST, &report())).unwrap();
+        assert_eq!(report.passed.len(), KEY_COUNT);
+        assert_eq!(report.passed.iter().filter(|passed| !**passed).count(), 1);
+        assert!(!report.passed[5]);
+        assert_eq!(report.median, 0x0100);
+        assert_eq!(report.count, 2);
+        assert_eq!(report.alias, 0x01);
+        assert_eq!(report.outliers.len(), 2);
+        assert_eq!(report.outliers[0].key, 5);
+        assert_eq!(report.outliers[0].bounce, 2);
+        assert_eq!(report.outliers[1].key, 60);
+        assert_eq!(report.outliers[1].duration, 0x0300);
+    }
+
+    #[test]
+    fn rejects_other_replies() {
+        let params = report();
+        assert!(TestReport::from_reply(&reply(REPLY_SUCCESS, &params)).is_none());
+        assert!(TestReport::from_reply(&reply(REPLY_TEST, &params[..14])).is_none());
+        assert!(TestReport::from_reply(&reply(REPLY_TEST, &params[..17])).is_none());
+        assert!(TestReport::from_reply(&reply(REPLY_TEST, &params[..15])).is_some());
+    }
+
+    #[test]
+    fn checks_limits() {
+        let report = TestReport::from_reply(&reply(REPLY_TEST, &report())).unwrap();
+        let strict = Limits {
+            max_spread: 2.5,
+            max_outliers: 1,
+        };
+        assert_eq!(
+            report.check(&strict),
+            vec![
+                Failure::TooManyOutliers(2),
+                Failure::Alias(0x01),
+                Failure::Key(5),
+                Failure::Spread(60, 0x0300),
+            ]
+        );
+
+        // a spread of 3 is within limits, the failed key never is
+        let loose = Limits {
+            max_spread: 3.0,
+            max_outliers: 2,
+        };
+        assert_eq!(report.check(&loose), vec![Failure::Alias(0x01), Failure::Key(5)]);
+    }
+
+    #[test]
+    fn fails_untouched_keybed() {
+        let mut params = vec![0; 11];
+        params.extend([0xff, 0xff, 0x58, 0x00].iter());
+        let report = TestReport::from_reply(&reply(REPLY_TEST, &params)).unwrap();
+        let limits = Limits {
+            max_spread: 2.0,
+            max_outliers: 0,
+        };
+        assert_eq!(report.check(&limits), vec![Failure::NotStruck]);
+    }
+}
@@ -1,3 +1,11 @@
 pub mod command;
 
 pub mod reply;
+
+pub mod profile;
+
+pub mod benchmark;
+
+pub mod curve;
+
+pub mod factory;
@@ -2,19 +2,356 @@ extern crate portmidi as pm;
 
 extern crate sysexprog;
 
+use std::env;
+use std::fs::File;
+use std::io::Read;
+use std::process;
+use std::thread;
+use std::time::{Duration, Instant};
+
+use sysexprog::benchmark::{cycles_per_event, BenchResult, EncodingResult, Source};
 use sysexprog::command::*;
+use sysexprog::curve::{Curve, PASS_TICKS};
+use sysexprog::factory::{Failure, Limits, TestReport};
+use sysexprog::profile::{Histogram, SymbolTable};
+use sysexprog::reply::{Assembler, Reply, REPLY_SUCCESS};
+
+const USAGE: &'static str = "usage: sysexprog <input> <output> <command> [args]
+
+<input> and <output> are PortMidi device ids.
+
+commands:
+  ping
+  benchmark [passes]
+      runs every scan kernel idle and on a synthetic burst, and the
+      velocity lookup, for the given passes (default 1000) and prints
+      the cycles per pass and per event
+  curve [<gamma> <min> <max> <knee> <range>]
+      prints the velocity curve, after setting it if given; gamma is in
+      1/16, knee and range in ticks of 64 us
+  output <primary|secondary|both> <profile> [store]
+      selects the output profile of the ports, one of generic, compact,
+      note-off and high-res; kept across resets with store
+  settle <step> <us> [store]
+      sets the settle time of a mux step (0-11, scan order) to 1-47 us;
+      kept across resets with store
+  test <start|dump|stop> [spread] [outliers]
+      factory test: start it, sweep the keybed once, then dump the report,
+      which fails keys more than spread (default 3) times as fast or slow
+      as the median and more than the given outliers (default 4)
+  profile <firmware.sym> [base] [shift] [seconds]
+      samples the program counter for a while (default: the whole
+      program in buckets of 2^9 words for 10 s) and prints the time
+      spent per symbol; firmware.sym is written by `make symbols` in
+      firmware/, base is a flash word address";
+
+const REPLY_TIMEOUT_MS: u64 = 2000;
+
+fn usage() -> ! {
+    eprintln!("{}", USAGE);
+    process::exit(1);
+}
+
+fn arg<T: std::str::FromStr>(args: &[String], index: usize, default: T) -> T {
+    match args.get(index) {
+        Some(arg) => arg.parse().unwrap_or_else(|_| usage()),
+        None => default,
+    }
+}
+
+fn send(output: &mut pm::OutputPort, command: &dyn Command) {
+    output
+        .write_sysex(0, &command.to_sysex())
+        .expect("cannot write to the output device");
+}
+
+// Waits for the next reply of the board, skipping anything else it plays.
+fn receive(input: &pm::InputPort, timeout: Duration) -> Reply {
+    let start = Instant::now();
+    let mut assembler = Assembler::new();
+    while start.elapsed() < timeout {
+        let events = input.read_n(64).expect("cannot read from the input device");
+        for event in events.unwrap_or(Vec::new()) {
+            let message = event.message;
+            match assembler.push(&[message.status, message.data1, message.data2, message.data3]) {
+                Some(Ok(reply)) => return reply,
+                Some(Err(error)) => eprintln!("dropped a malformed reply: {:?}", error),
+                None => {}
+            }
+        }
+        thread::sleep(Duration::from_millis(1));
+    }
+    eprintln!("no reply from the board");
+    process::exit(1);
+}
+
+// Sends a command and returns its reply; an error reply ends the program.
+fn exchange(input: &pm::InputPort, output: &mut pm::OutputPort, command: &dyn Command) -> Reply {
+    send(output, command);
+    let reply = receive(input, Duration::from_millis(REPLY_TIMEOUT_MS));
+    if let Some(error) = reply.error() {
+        eprintln!("the board replied with error 0x{:02x}", error);
+        process::exit(1);
+    }
+    reply
+}
+
+fn ping(input: &pm::InputPort, output: &mut pm::OutputPort) {
+    let start = Instant::now();
+    exchange(input, output, &Ping {});
+    println!("reply after {:?}", start.elapsed());
+}
+
+// The board sends one reply per kernel and source, one per output profile,
+// then success.
+fn benchmark(input: &pm::InputPort, output: &mut pm::OutputPort, args: &[String]) {
+    let passes: u16 = arg(args, 0, 1000);
+    if passes == 0 {
+        usage();
+    }
+    send(output, &Benchmark { passes: passes });
+
+    let mut idle: Vec<BenchResult> = Vec::new();
+    loop {
+        // a run can take a while, 6 channels per pass at well under 64k
+        // cycles each is at most 25 ms per pass at 16 MHz
+        let reply = receive(
+            input,
+            Duration::from_millis(REPLY_TIMEOUT_MS + 25 * passes as u64),
+        );
+        if reply.command == REPLY_SUCCESS {
+            break;
+        }
+        if let Some(error) = reply.error() {
+            eprintln!("the board replied with error 0x{:02x}", error);
+            process::exit(1);
+        }
+        if let Some(encoding) = EncodingResult::from_reply(&reply) {
+            println!(
+                "output {:8}  {:10.1} cycles/event  {:5.2} bytes/event",
+                OUTPUT_NAMES.get(encoding.profile as usize).unwrap_or(&"?"),
+                encoding.cycles_per_event(),
+                encoding.bytes_per_event()
+            );
+            continue;
+        }
+        let result = match BenchResult::from_reply(&reply) {
+            Some(result) => result,
+            None => continue,
+        };
+
+        print!(
+            "kernel {} {:8}  {:10.1} cycles/{}",
+            result.kernel,
+            format!("{:?}", result.source).to_lowercase(),
+            result.cycles_per_pass(),
+            if result.source == Source::Velocity {
+                "lookup"
+            } else {
+                "pass"
+            }
+        );
+        if result.source == Source::Burst {
+            let per_event = idle
+                .iter()
+                .find(|run| run.kernel == result.kernel)
+                .and_then(|run| cycles_per_event(run, &result));
+            if let Some(per_event) = per_event {
+                print!("  {:8.1} cycles/event", per_event);
+            }
+        }
+        println!();
+        if result.source == Source::Idle {
+            idle.push(result);
+        }
+    }
+}
+
+fn curve(input: &pm::InputPort, output: &mut pm::OutputPort, args: &[String]) {
+    let reply = match args.len() {
+        0 => exchange(input, output, &GetCurve {}),
+        5 => {
+            let set = SetCurve {
+                gamma: arg(args, 0, 0),
+                min: arg(args, 1, 0),
+                max: arg(args, 2, 0),
+                knee: arg(args, 3, 0),
+                range: arg(args, 4, 0),
+            };
+            exchange(input, output, &set)
+        }
+        _ => usage(),
+    };
+    let curve = Curve::from_reply(&reply).unwrap_or_else(|| {
+        eprintln!("unexpected reply 0x{:02x}", reply.command);
+        process::exit(1);
+    });
+
+    println!(
+        "gamma {:.2}, velocities {}-{}, knee {} ticks, range {} ticks",
+        curve.gamma as f64 / 16.0,
+        curve.min,
+        curve.max,
+        curve.knee,
+        curve.range
+    );
+    println!("expanded in {} us", curve.expand_micros());
+    println!(
+        "mean velocity error timed in passes of {} ticks: {:.3}",
+        PASS_TICKS,
+        curve.quantization_error(PASS_TICKS)
+    );
+}
+
+fn set_output(input: &pm::InputPort, output: &mut pm::OutputPort, args: &[String]) {
+    let ports = match args.get(0).map(|arg| arg.as_str()) {
+        Some("primary") => PORT_PRIMARY,
+        Some("secondary") => PORT_SECONDARY,
+        Some("both") => PORT_PRIMARY | PORT_SECONDARY,
+        _ => usage(),
+    };
+    let profile = args
+        .get(1)
+        .and_then(|name| output_profile(name))
+        .unwrap_or_else(|| usage());
+    let store = match args.get(2).map(|arg| arg.as_str()) {
+        None => false,
+        Some("store") => true,
+        _ => usage(),
+    };
+
+    let command = SetOutput {
+        ports: ports,
+        profile: profile,
+        store: store,
+    };
+    exchange(input, output, &command);
+}
+
+fn settle(input: &pm::InputPort, output: &mut pm::OutputPort, args: &[String]) {
+    if args.len() < 2 {
+        usage();
+    }
+    let store = match args.get(2).map(|arg| arg.as_str()) {
+        None => false,
+        Some("store") => true,
+        _ => usage(),
+    };
+
+    let command = SetSettle {
+        step: arg(args, 0, 0),
+        micros: arg(args, 1, 0),
+        store: store,
+    };
+    exchange(input, output, &command);
+}
+
+fn test(input: &pm::InputPort, output: &mut pm::OutputPort, args: &[String]) {
+    match args.get(0).map(|arg| arg.as_str()) {
+        Some("start") => {
+            exchange(input, output, &TestStart {});
+            return;
+        }
+        Some("stop") => {
+            exchange(input, output, &TestStop {});
+            return;
+        }
+        Some("dump") => {}
+        _ => usage(),
+    }
+
+    let limits = Limits {
+        max_spread: arg(args, 1, 3.0),
+        max_outliers: arg(args, 2, 4),
+    };
+    let reply = exchange(input, output, &TestDump {});
+    let report = TestReport::from_reply(&reply).unwrap_or_else(|| {
+        eprintln!("unexpected reply 0x{:02x}", reply.command);
+        process::exit(1);
+    });
+
+    println!(
+        "median {} us, {} outliers",
+        report.median as u32 * 64,
+        report.count
+    );
+    for outlier in &report.outliers {
+        println!(
+            "  key {:2}  {:5} us  {} bounces",
+            outlier.key,
+            outlier.duration as u32 * 64,
+            outlier.bounce
+        );
+    }
+
+    let failures = report.check(&limits);
+    for failure in &failures {
+        match *failure {
+            Failure::NotStruck => println!("FAIL no key was struck"),
+            Failure::TooManyOutliers(count) => println!("FAIL {} outliers", count),
+            Failure::Alias(lines) => println!("FAIL activity on alias lines 0x{:02x}", lines),
+            Failure::Key(key) => println!("FAIL key {}", key),
+            Failure::Spread(key, duration) => {
+                println!("FAIL key {} at {} us", key, duration as u32 * 64)
+            }
+        }
+    }
+    if !failures.is_empty() {
+        process::exit(2);
+    }
+    println!("PASS");
+}
+
+fn profile(input: &pm::InputPort, output: &mut pm::OutputPort, args: &[String]) {
+    let mut listing = String::new();
+    File::open(args.get(0).unwrap_or_else(|| usage()))
+        .and_then(|mut file| file.read_to_string(&mut listing))
+        .expect("cannot read the symbol file");
+    let symbols = SymbolTable::from_nm(&listing);
+
+    let start = ProfileStart {
+        base: arg(args, 1, 0),
+        shift: arg(args, 2, 9),
+    };
+    exchange(input, output, &start);
+    thread::sleep(Duration::from_secs(arg(args, 3, 10)));
+    let reply = exchange(input, output, &ProfileDump {});
+    let histogram = Histogram::from_reply(&reply).unwrap_or_else(|| {
+        eprintln!("unexpected reply 0x{:02x}", reply.command);
+        process::exit(1);
+    });
+
+    let samples = histogram.samples();
+    println!("{} samples", samples);
+    for (name, count) in symbols.attribute(&histogram) {
+        println!("{:6.2}%  {}", 100.0 * count / samples.max(1) as f64, name);
+    }
+}
 
 fn main() {
-    //  let context = pm::PortMidi::new().unwrap();
-
-    /*  let device_id = 3;
-  hallo();
-  context
-    .device(device_id)
-    .and_then(|dev| context.output_port(dev, 1024))
-    .and_then(|port| port.write_sysex(0, &[240, 0, 112, 1, 1, 0, 1, 0, 247])).unwrap();
-*/
-
-    let ping = Ping {};
-    print!("{:?}", ping.to_sysex());
+    let args: Vec<String> = env::args().skip(1).collect();
+    if args.len() < 3 {
+        usage();
+    }
+
+    let context = pm::PortMidi::new().expect("cannot initialize PortMidi");
+    let input = context
+        .device(arg(&args, 0, 0))
+        .and_then(|device| context.input_port(device, 1024))
+        .expect("cannot open the input device");
+    let mut output = context
+        .device(arg(&args, 1, 0))
+        .and_then(|device| context.output_port(device, 1024))
+        .expect("cannot open the output device");
+
+    match args[2].as_str() {
+        "ping" => ping(&input, &mut output),
+        "benchmark" => benchmark(&input, &mut output, &args[3..]),
+        "curve" => curve(&input, &mut output, &args[3..]),
+        "output" => set_output(&input, &mut output, &args[3..]),
+        "settle" => settle(&input, &mut output, &args[3..]),
+        "test" => test(&input, &mut output, &args[3..]),
+        "profile" => profile(&input, &mut output, &args[3..]),
+        _ => usage(),
+    }
 }
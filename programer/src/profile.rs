@@ -0,0 +1,196 @@
+use reply::{read_u16, Reply, REPLY_PROFILE};
+
+// Histogram as dumped by the firmware's PC sampler. Addresses are flash word
+// addresses, bucket i covers [base + (i << shift), base + ((i + 1) << shift)).
+pub struct Histogram {
+    pub base: u16,
+    pub shift: u8,
+    pub other: u16,
+    pub buckets: Vec<u16>,
+}
+
+impl Histogram {
+    pub fn from_reply(reply: &Reply) -> Option<Histogram> {
+        let params = &reply.params;
+        if reply.command != REPLY_PROFILE || params.len() < 5 || params.len() % 2 != 1 {
+            return None;
+        }
+
+        Some(Histogram {
+            base: read_u16(params, 0),
+            shift: params[2],
+            other: read_u16(params, 3),
+            buckets: (5..params.len())
+                .step_by(2)
+                .map(|offset| read_u16(params, offset))
+                .collect(),
+        })
+    }
+
+    // Byte address range of a bucket, as used by the symbol table.
+    pub fn bucket_range(&self, bucket: usize) -> (u32, u32) {
+        let start = self.base as u32 + ((bucket as u32) << self.shift);
+        let end = start + (1 << self.shift);
+        (start * 2, end * 2)
+    }
+
+    pub fn samples(&self) -> u32 {
+        self.buckets.iter().fold(self.other as u32, |acc, val| acc + *val as u32)
+    }
+}
+
+pub struct Symbol {
+    pub addr: u32,
+    pub name: String,
+}
+
+pub struct SymbolTable {
+    symbols: Vec<Symbol>,
+}
+
+impl SymbolTable {
+    // Parses the output of `avr-nm -n -C firmware.obj` (see the symbols
+    // target in firmware/runfile). Only code symbols are kept, including
+    // the weak ones of the inline helpers the PROFILER build keeps out of
+    // line.
+    pub fn from_nm(listing: &str) -> SymbolTable {
+        let mut symbols: Vec<Symbol> = listing
+            .lines()
+            .filter_map(|line| {
+                let mut fields = line.splitn(3, ' ');
+                let addr = fields.next().and_then(|f| u32::from_str_radix(f, 16).ok());
+                let kind = fields.next();
+                let name = fields.next();
+                match (addr, kind, name) {
+                    (Some(addr), Some("T"), Some(name))
+                    | (Some(addr), Some("t"), Some(name))
+                    | (Some(addr), Some("W"), Some(name))
+                    | (Some(addr), Some("w"), Some(name)) => {
+                        Some(Symbol {
+                            addr: addr,
+                            name: name.to_string(),
+                        })
+                    }
+                    _ => None,
+                }
+            })
+            .collect();
+        symbols.sort_by_key(|symbol| symbol.addr);
+        SymbolTable { symbols: symbols }
+    }
+
+    pub fn lookup(&self, addr: u32) -> Option<&Symbol> {
+        match self.symbols.binary_search_by_key(&addr, |symbol| symbol.addr) {
+            Ok(index) => Some(&self.symbols[index]),
+            Err(0) => None,
+            Err(index) => Some(&self.symbols[index - 1]),
+        }
+    }
+
+    // Spreads the samples of every bucket over the symbols it overlaps,
+    // proportionally to the overlap, and returns the totals per symbol with
+    // the hottest first. Samples outside the window are reported as "<other>".
+    pub fn attribute(&self, histogram: &Histogram) -> Vec<(String, f64)> {
+        let mut totals: Vec<(String, f64)> = Vec::new();
+        let mut add = |name: &str, samples: f64| {
+            match totals.iter_mut().find(|entry| entry.0 == name) {
+                Some(entry) => entry.1 += samples,
+                None => totals.push((name.to_string(), samples)),
+            }
+        };
+
+        for (bucket, count) in histogram.buckets.iter().enumerate() {
+            if *count == 0 {
+                continue;
+            }
+            let (start, end) = histogram.bucket_range(bucket);
+            let mut addr = start;
+            while addr < end {
+                let next = self
+                    .symbols
+                    .iter()
+                    .map(|symbol| symbol.addr)
+                    .find(|symbol_addr| *symbol_addr > addr)
+                    .map_or(end, |symbol_addr| symbol_addr.min(end));
+                let name = self.lookup(addr).map_or("<unknown>", |symbol| &symbol.name);
+                add(name, *count as f64 * (next - addr) as f64 / (end - start) as f64);
+                addr = next;
+            }
+        }
+        if histogram.other > 0 {
+            add("<other>", histogram.other as f64);
+        }
+
+        totals.sort_by(|a, b| b.1.partial_cmp(&a.1).unwrap());
+        totals
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use reply::to_sysex;
+
+    // base 0x0100, shift 4, 3 samples outside, 32 buckets of which the first
+    // two have 6 and 2 samples
+    fn histogram() -> Histogram {
+        let mut params = vec![0x00, 0x01, 0x04, 0x03, 0x00];
+        params.extend([6, 0, 2, 0].iter());
+        params.extend([0; 60].iter());
+        let reply = Reply::from_sysex(&to_sysex(REPLY_PROFILE, &params)).unwrap();
+        Histogram::from_reply(&reply).unwrap()
+    }
+
+    const LISTING: &'static str = "00000000 T __vectors
+00000000 a __tmp_reg__
+00000200 T main
+00000210 W scan_channel(unsigned char)
+00000800 B pedals
+00000a00 t __vector_19";
+
+    #[test]
+    fn decodes_histogram() {
+        let histogram = histogram();
+        assert_eq!(histogram.base, 0x0100);
+        assert_eq!(histogram.shift, 4);
+        assert_eq!(histogram.buckets.len(), 32);
+        assert_eq!(histogram.samples(), 11);
+        assert_eq!(histogram.bucket_range(1), (0x220, 0x240));
+    }
+
+    #[test]
+    fn rejects_other_replies() {
+        let reply = Reply {
+            command: REPLY_PROFILE,
+            params: vec![0x00, 0x01, 0x04, 0x03],
+        };
+        assert!(Histogram::from_reply(&reply).is_none());
+    }
+
+    #[test]
+    fn keeps_code_symbols() {
+        let table = SymbolTable::from_nm(LISTING);
+        assert_eq!(table.lookup(0x1ff).unwrap().name, "__vectors");
+        assert_eq!(table.lookup(0x20f).unwrap().name, "main");
+        assert_eq!(
+            table.lookup(0x900).unwrap().name,
+            "scan_channel(unsigned char)"
+        );
+        assert_eq!(table.lookup(0xa02).unwrap().name, "__vector_19");
+    }
+
+    #[test]
+    fn attributes_buckets() {
+        // bucket 0 covers bytes 0x200-0x220, split evenly between main and
+        // scan_channel; bucket 1 lies in scan_channel
+        let totals = SymbolTable::from_nm(LISTING).attribute(&histogram());
+        assert_eq!(
+            totals,
+            vec![
+                ("scan_channel(unsigned char)".to_string(), 5.0),
+                ("main".to_string(), 3.0),
+                ("<other>".to_string(), 3.0),
+            ]
+        );
+    }
+}
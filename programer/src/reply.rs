@@ -1 +1,236 @@
+use std::mem;
 
+use command::{FOOTER, HEADER};
+
+pub const REPLY_SUCCESS: u8 = 0x20;
+pub const REPLY_ERROR: u8 = 0x21;
+pub const REPLY_READ: u8 = 0x22;
+pub const REPLY_VERIFY: u8 = 0x23;
+pub const REPLY_PROFILE: u8 = 0x40;
+pub const REPLY_BENCHMARK: u8 = 0x41;
+pub const REPLY_CURVE: u8 = 0x42;
+pub const REPLY_ENCODING: u8 = 0x43;
+pub const REPLY_TEST: u8 = 0x44;
+
+pub const ERROR_VERIFY_MISMATCH: u8 = 0x09;
+pub const ERROR_TEST_ACTIVE: u8 = 0x11;
+
+#[derive(Debug, PartialEq)]
+pub enum ParseError {
+    InvalidFraming,
+    InvalidNibble,
+    InvalidChecksum,
+}
+
+#[derive(Debug)]
+pub struct Reply {
+    pub command: u8,
+    pub params: Vec<u8>,
+}
+
+impl Reply {
+    pub fn from_sysex(message: &[u8]) -> Result<Reply, ParseError> {
+        if message.len() < HEADER.len() + FOOTER.len() + 4
+            || !message.starts_with(&HEADER)
+            || !message.ends_with(&FOOTER)
+            || (message.len() - HEADER.len() - FOOTER.len()) % 2 != 0
+        {
+            return Err(ParseError::InvalidFraming);
+        }
+
+        let nibbles = &message[HEADER.len()..message.len() - FOOTER.len()];
+        if nibbles.iter().any(|nibble| *nibble > 0x0f) {
+            return Err(ParseError::InvalidNibble);
+        }
+
+        let mut payload: Vec<u8> = nibbles
+            .chunks(2)
+            .map(|pair| (pair[0] << 4) | pair[1])
+            .collect();
+        if payload.iter().fold(0, |acc, val| acc ^ val) != 0 {
+            return Err(ParseError::InvalidChecksum);
+        }
+        payload.pop();
+
+        let command = payload.remove(0);
+        Ok(Reply {
+            command: command,
+            params: payload,
+        })
+    }
+
+    pub fn error(&self) -> Option<u8> {
+        if self.command == REPLY_ERROR {
+            self.params.first().cloned()
+        } else {
+            None
+        }
+    }
+
+    // A write that did not read back correctly reports the first bad offset
+    // within the page.
+    pub fn mismatch_offset(&self) -> Option<u8> {
+        match self.error() {
+            Some(ERROR_VERIFY_MISMATCH) => self.params.get(1).cloned(),
+            _ => None,
+        }
+    }
+}
+
+pub fn read_u16(params: &[u8], offset: usize) -> u16 {
+    params[offset] as u16 | (params[offset + 1] as u16) << 8
+}
+
+pub fn read_u32(params: &[u8], offset: usize) -> u32 {
+    read_u16(params, offset) as u32 | (read_u16(params, offset + 2) as u32) << 16
+}
+
+// Reassembles SysEx messages from MIDI input events of four bytes each. A
+// SysEx message spans several events; any other message is an event of its
+// own, padded with zeros, and is skipped. Real-time bytes may also appear
+// within SysEx events.
+pub struct Assembler {
+    message: Vec<u8>,
+}
+
+impl Assembler {
+    pub fn new() -> Assembler {
+        Assembler {
+            message: Vec::new(),
+        }
+    }
+
+    pub fn push(&mut self, event: &[u8]) -> Option<Result<Reply, ParseError>> {
+        match event.first() {
+            Some(&0xf0) | Some(&0xf7) => {}
+            Some(&status) if status >= 0xf8 => return None,
+            Some(&status) if status >= 0x80 => {
+                self.message.clear();
+                return None;
+            }
+            _ => {}
+        }
+
+        for byte in event {
+            match *byte {
+                0xf8..=0xff => {}
+                0xf0 => {
+                    self.message.clear();
+                    self.message.push(0xf0);
+                }
+                0xf7 if !self.message.is_empty() => {
+                    self.message.push(0xf7);
+                    let message = mem::replace(&mut self.message, Vec::new());
+                    return Some(Reply::from_sysex(&message));
+                }
+                0x80..=0xf7 => self.message.clear(),
+                _ if !self.message.is_empty() => self.message.push(*byte),
+                _ => {}
+            }
+        }
+        None
+    }
+}
+
+// The firmware's send_msg, for building replies in tests.
+#[cfg(test)]
+pub fn to_sysex(command: u8, params: &[u8]) -> Vec<u8> {
+    let mut message = HEADER.to_vec();
+    let mut checksum = command;
+    message.push(command >> 4);
+    message.push(command & 0x0f);
+    for byte in params {
+        message.push(byte >> 4);
+        message.push(byte & 0x0f);
+        checksum ^= byte;
+    }
+    message.push(checksum >> 4);
+    message.push(checksum & 0x0f);
+    message.extend(FOOTER.iter());
+    message
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    // as sent by send_msg for reply_success()
+    const SUCCESS: [u8; 9] = [0xf0, 0x00, 0x70, 0x01, 0x02, 0x00, 0x02, 0x00, 0xf7];
+
+    // reply_error(ERROR_VERIFY_MISMATCH) followed by offset 5, checksum 0x2d
+    const MISMATCH: [u8; 13] = [
+        0xf0, 0x00, 0x70, 0x01, 0x02, 0x01, 0x00, 0x09, 0x00, 0x05, 0x02, 0x0d, 0xf7,
+    ];
+
+    #[test]
+    fn decodes_success() {
+        let reply = Reply::from_sysex(&SUCCESS).unwrap();
+        assert_eq!(reply.command, REPLY_SUCCESS);
+        assert!(reply.params.is_empty());
+        assert_eq!(reply.error(), None);
+    }
+
+    #[test]
+    fn decodes_mismatch_offset() {
+        let reply = Reply::from_sysex(&MISMATCH).unwrap();
+        assert_eq!(reply.error(), Some(ERROR_VERIFY_MISMATCH));
+        assert_eq!(reply.mismatch_offset(), Some(5));
+        assert_eq!(to_sysex(REPLY_ERROR, &[ERROR_VERIFY_MISMATCH, 5]), MISMATCH);
+    }
+
+    #[test]
+    fn rejects_bad_messages() {
+        let mut checksum = SUCCESS;
+        checksum[7] = 0x01;
+        assert_eq!(
+            Reply::from_sysex(&checksum).unwrap_err(),
+            ParseError::InvalidChecksum
+        );
+
+        let mut nibble = SUCCESS;
+        nibble[5] = 0x10;
+        assert_eq!(
+            Reply::from_sysex(&nibble).unwrap_err(),
+            ParseError::InvalidNibble
+        );
+
+        assert_eq!(
+            Reply::from_sysex(&SUCCESS[..8]).unwrap_err(),
+            ParseError::InvalidFraming
+        );
+        assert_eq!(
+            Reply::from_sysex(&MISMATCH[1..]).unwrap_err(),
+            ParseError::InvalidFraming
+        );
+    }
+
+    #[test]
+    fn reads_little_endian() {
+        let params = [0x34, 0x12, 0x78, 0x56];
+        assert_eq!(read_u16(&params, 0), 0x1234);
+        assert_eq!(read_u32(&params, 0), 0x56781234);
+    }
+
+    #[test]
+    fn assembles_events() {
+        let mut assembler = Assembler::new();
+        // a note-on, then the reply with a clock in between
+        assert!(assembler.push(&[0x90, 0x40, 0x5c, 0x00]).is_none());
+        assert!(assembler.push(&SUCCESS[0..4]).is_none());
+        assert!(assembler.push(&[0xf8, 0x00, 0x00, 0x00]).is_none());
+        assert!(assembler.push(&SUCCESS[4..8]).is_none());
+        let reply = assembler.push(&[0xf7, 0x00, 0x00, 0x00]);
+        assert_eq!(reply.unwrap().unwrap().command, REPLY_SUCCESS);
+
+        // a clock within a SysEx event
+        assert!(assembler.push(&[0xf0, 0x00, 0xf8, 0x70]).is_none());
+        assert!(assembler.push(&SUCCESS[3..7]).is_none());
+        let reply = assembler.push(&SUCCESS[7..]);
+        assert_eq!(reply.unwrap().unwrap().command, REPLY_SUCCESS);
+
+        // a message cut short by a status byte is dropped
+        assert!(assembler.push(&MISMATCH[0..6]).is_none());
+        assert!(assembler.push(&[0x80, 0x40, 0x00, 0x00]).is_none());
+        assert!(assembler.push(&MISMATCH[6..]).is_none());
+    }
+}